@@ -28,6 +28,9 @@
 #include "key.h"
 #include "memory.h"
 #include "morse.h"
+#include "tasks.h"
+#include "trace.h"
+#include "vfo.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -45,15 +48,18 @@ enum state
   S_TUNE,
   S_CHANGE_BAND,
   S_DFE,
+  S_CHANNEL,
   S_MEM_SEND_WAIT,
   S_MEM_SEND_TX,
   S_MEM_ENTER_WAIT,
   S_MEM_ENTER,
   S_MEM_ENTER_REVIEW,
+  S_CALL_ENTER,
   S_CALIBRATION_CORRECTION,
   S_CALIBRATION_PEAK_IF,
   S_CALIBRATION_CHANGE_BAND,
   S_CALIBRATION_PEAK_RX,
+  S_CONFIRM,
   S_ERROR
 };
 
@@ -65,20 +71,23 @@ struct atsamf {
   enum band band;
   unsigned long op_freq;
   unsigned long rit_tx_freq;
+  unsigned long vfo_other_freq;
 
   unsigned char rit:1;
+  unsigned char split:1;
+  unsigned char vfo:1;
   unsigned char tuning_step:3;
 
   unsigned char tune_mode_on:1;
 
   unsigned char beacon:1;
-  unsigned char mem_tx_index;
 
   struct display display;
   volatile struct inputs inputs;
 };
 
-#define TX_FREQ(state) (state.rit ? state.rit_tx_freq : state.op_freq)
+#define TX_FREQ(state) (state.rit ? state.rit_tx_freq : \
+    state.split ? state.vfo_other_freq : state.op_freq)
 
 extern struct atsamf state;
 extern volatile unsigned long tcount;
@@ -86,11 +95,14 @@ extern const byte tuning_blinks[];
 extern byte errno;
 
 extern byte memory_index;
-extern char buffer[MEMORY_LENGTH];
+extern byte channel_index;
 
 extern byte dfe_position;
 extern unsigned long dfe_freq;
 
+void watchdog_feed(void);
+void hang_poll(void);
+
 
 #define SIDETONE A0
 #define MUTE A1
@@ -105,6 +117,7 @@ extern unsigned long dfe_freq;
 #define EEPROM_BAND      6 // 1 byte
 #define EEPROM_CW_SPEED  7 // 1 byte
 #define EEPROM_CAL_VALUE 8 // 4 bytes
+#define EEPROM_SERIAL   12 // 2 bytes
 
 #ifdef __cplusplus
 }
@@ -46,6 +46,8 @@
 #include <Wire.h>
 #include <avr/power.h>
 #include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <stddef.h>
 
 #include <si5351.h>
 
@@ -68,7 +70,8 @@ const byte tuning_blinks[] = TUNING_STEP_DIGITS;
 byte errno;
 
 byte memory_index;
-char buffer[MEMORY_LENGTH];
+
+byte channel_index;
 
 byte dfe_position;
 unsigned long dfe_freq;
@@ -81,37 +84,98 @@ unsigned long IFfreq;
 
 const long tuning_steps[] = TUNING_STEPS;
 
+/**
+ * A snapshot of the operating state, used to resume operation after a reset by
+ * the watchdog. It lives in the .noinit section so that it survives the reset;
+ * the magic word and the checksum tell us whether it is valid or RAM garbage
+ * after power-on.
+ */
+#define SNAPSHOT_MAGIC 0x5a3c
+
+struct snapshot {
+  unsigned int magic;
+  enum state state;
+  enum band band;
+  unsigned long op_freq;
+  unsigned long rit_tx_freq;
+  unsigned long vfo_other_freq;
+  unsigned char rit:1;
+  unsigned char split:1;
+  unsigned char vfo:1;
+  unsigned char speed:5;
+  byte error;
+  byte checksum;
+};
+
+static struct snapshot snapshot __attribute__((section(".noinit")));
+
+/**
+ * The cause of the last reset, in the format of MCUSR (see save_reset_cause()).
+ */
+static byte reset_cause __attribute__((section(".noinit")));
+
 byte memory_index_character;
-byte memory_pointer;
 
 byte dfe_character;
 
+byte call_character;
+
 /**
- * The Timer1 ISR. Keeps track of a global timer, tcount, and calls ISRs for
- * all parts of the system.
- * See also key_isr(), buttons_isr() and display_isr().
+ * The Timer1 ISR. Keeps track of a global timer, tcount, calls ISRs for all
+ * parts of the system and posts the tasks that should run.
+ * See also key_isr(), buttons_isr() and tasks_isr().
  */
 ISR (TIMER1_COMPA_vect)
 {
   ++tcount;
   key_isr();
   buttons_isr();
+  tasks_isr();
 }
 
-static uint8_t confirm (const char *question)
+/**
+ * The action that is performed when the user confirms in S_CONFIRM.
+ */
+static void (*confirm_action)(void);
+
+/**
+ * Ask the user to confirm an action. This moves to S_CONFIRM, where the keyer
+ * switch performs the action and the RIT switch cancels it (see
+ * loop_confirm()).
+ */
+static void confirm(const char *question, void (*action)(void))
 {
+  state.state = S_CONFIRM;
+  confirm_action = action;
   display_question(question);
+}
 
-  while (1) {
-    if (state.inputs.keyer) {
-      debounce_keyer();
-      return 1;
-    } else if (state.inputs.rit) {
-      debounce_rit();
-      return 0;
-    }
-    delay(1);
-  }
+/**
+ * Start the calibration routine after confirmation in S_CONFIRM.
+ */
+static void confirm_calibrate(void)
+{
+  state.state = S_CALIBRATION_CORRECTION;
+  calibration_set_correction();
+  enable_rx_tx(RX_OFF_TX_ON);
+  invalidate_display();
+}
+
+/**
+ * Save the reset cause, clear MCUSR and disable the watchdog before anything
+ * else runs. After a watchdog reset the watchdog stays enabled with the
+ * shortest timeout, so this cannot wait until setup().
+ * Optiboot clears MCUSR itself and passes its old value in r2, so both are
+ * combined. Without Optiboot r2 is undefined, but reset_cause is only used to
+ * rule out a resume after power-on, so at worst a resume is skipped.
+ */
+void save_reset_cause(void) __attribute__((naked, used, section(".init3")));
+void save_reset_cause(void)
+{
+  asm volatile ("sts %0, r2" : "=m" (reset_cause));
+  reset_cause |= MCUSR;
+  MCUSR = 0;
+  wdt_disable();
 }
 
 /**
@@ -138,6 +202,8 @@ void setup(void)
 
   display_init();
 
+  byte resume = !(reset_cause & (1 << PORF | 1 << BORF)) && snapshot_valid();
+
   state.key.mode = KEY_IAMBIC;
   state.key.speed = EEPROM.read(EEPROM_CW_SPEED);
   if (state.key.speed > KEY_MAX_SPEED)
@@ -169,18 +235,28 @@ void setup(void)
   }
 
   fetch_calibration_data(); //load calibration data
+  load_serial();
+  callsign_clear();
   si5351.set_correction(cal_value); //correct the clock chip error
   state.tuning_step = 0;
-  setup_band();
 
-  display_delay(1500);
+  if (resume) {
+    /* skip the startup screen; the reset is reported below */
+    resume_snapshot();
+  } else {
+    setup_band();
 
-  if (state.state == S_DEFAULT) {
-    state.state = S_STARTUP; // To show the band on startup
-    invalidate_display();
     display_delay(1500);
-    state.state = S_DEFAULT;
-  } else if (state.state == S_CALIBRATION_CORRECTION) {
+
+    if (state.state == S_DEFAULT) {
+      state.state = S_STARTUP; // To show the band on startup
+      invalidate_display();
+      display_delay(1500);
+      state.state = S_DEFAULT;
+    }
+  }
+
+  if (state.state == S_CALIBRATION_CORRECTION) {
     calibration_set_correction();
     enable_rx_tx(RX_OFF_TX_ON);
   }
@@ -193,43 +269,134 @@ void setup(void)
 
   state.beacon = 0;
 
+  if (resume)
+    display_reset_report(snapshot.error, snapshot.state);
+  snapshot.error = 0;
+
   power_adc_disable();
   power_spi_disable();
   set_sleep_mode(SLEEP_MODE_IDLE);
+
+#ifdef OPT_WATCHDOG
+  wdt_enable(WDTO_500MS);
+#endif
 }
 
 /**
- * Arduino's main loop. Checks what state we are in and calls the corresponding
- * loop_* function.
+ * Arduino's main loop. Runs the pending tasks (see tasks.ino) and sleeps when
+ * there is nothing to do. In S_ERROR, the watchdog is only fed by loop_error().
  */
 void loop(void)
 {
-  if (!((uint8_t)tcount & 0x7f))
-    display_isr();
+  if (state.state != S_ERROR) {
+    watchdog_feed();
+    save_snapshot();
+  }
+
+  if (!tasks_run())
+    tasks_sleep();
+}
+
+/**
+ * The keying task: the states in which the keying timing matters. This runs
+ * on every tick while state.key.busy is set. Characters sent with morse() or
+ * morse_send() go first; the keyer is only started when nothing is being sent.
+ * When the keying ends, the input task is posted to handle the inputs that
+ * were deferred (see task_handle_input()).
+ */
+void task_handle_keying(void)
+{
+  byte busy = state.key.busy;
+
+  morse_poll();
+  if (!morse_busy()) {
+    switch (state.state) {
+      case S_KEYING:                loop_keying(); break;
+      case S_MEM_SEND_TX:           loop_mem_send_tx(); break;
+      case S_MEM_ENTER_REVIEW:      memory_record_playback_next(); break;
+      case S_DFE:
+      case S_MEM_ENTER:
+      case S_MEM_SEND_WAIT:
+      case S_CALL_ENTER:            loop_key_decode(); break;
+      default: break;
+    }
+  }
+
+  if (busy && !state.key.busy)
+    task_post(TASK_INPUT);
+}
+
+/**
+ * The RF task: enables RX after the semi-break-in hang time.
+ */
+void task_handle_rf(void)
+{
+  hang_poll();
+}
+
+/**
+ * The input task. Checks what state we are in and calls the corresponding
+ * loop_* function. This runs when an input has changed (see buttons_isr()) and
+ * when a handler has posted it again with task_post_in(), e.g. to time out.
+ * Inputs are handled between characters: while a character is keyed or
+ * played back, they are deferred. In S_MEM_SEND_TX, the buttons can stop the
+ * transmission at any time.
+ */
+void task_handle_input(void)
+{
+  if (state.key.busy && state.state != S_MEM_SEND_TX)
+    return;
+
+  buttons_poll();
 
   switch (state.state) {
     case S_DEFAULT:                 loop_default(); break;
-    case S_KEYING:                  loop_keying(); break;
+    case S_KEYING:                  break; /* see task_handle_keying() */
     case S_ADJUST_CS:               loop_adjust_cs(); break;
     case S_TUNE:                    loop_tune(); break;
     case S_CHANGE_BAND:             loop_change_band(); break;
     case S_DFE:                     loop_dfe(); break;
+    case S_CHANNEL:                 loop_channel(); break;
     case S_MEM_ENTER_WAIT:          loop_mem_enter_wait(); break;
     case S_MEM_ENTER:               loop_mem_enter(); break;
     case S_MEM_ENTER_REVIEW:        loop_mem_enter_review(); break;
+    case S_CALL_ENTER:              loop_call_enter(); break;
     case S_MEM_SEND_WAIT:           loop_mem_send_wait(); break;
-    case S_MEM_SEND_TX:             loop_mem_send_tx(); break;
+    case S_MEM_SEND_TX:             loop_mem_send_tx_buttons(); break;
     case S_CALIBRATION_CORRECTION:  loop_calibration_correction(); break;
     case S_CALIBRATION_PEAK_IF:     loop_calibration_peak_if(); break;
     case S_CALIBRATION_CHANGE_BAND: loop_change_band(); break;
     case S_CALIBRATION_PEAK_RX:     loop_calibration_peak_rx(); break;
+    case S_CONFIRM:                 loop_confirm(); break;
     case S_ERROR:                   loop_error(); break;
     default:
       error(1);
       break;
   }
 
-  sleep_mode();
+  /* the keyer is started by the keying task, see task_handle_keying() */
+  if (key_active())
+    task_post(TASK_KEYING);
+}
+
+/**
+ * The display task: blinking and the echo of keyed characters.
+ */
+void task_handle_display(void)
+{
+  display_isr();
+}
+
+/**
+ * The EEPROM task: writes settings that have changed when idle, since every
+ * byte blocks for 3.3ms, and the memory that is being recorded.
+ */
+void task_handle_eeprom(void)
+{
+  if (state.state == S_DEFAULT)
+    serial_flush();
+  memory_record_flush();
+  channel_flush();
 }
 
 /**
@@ -238,10 +405,16 @@ void loop(void)
  *
  * Paddle or straight key enter the S_KEYING state.
  *
+ * The buttons act when they are released, depending on how long they were
+ * held. While a button is held, the selected option is shown (see time_rit()).
+ *
  * Rotary encoder:
  * - Turning adjusts the frequencies in the current step size.
  * - Pressing rotates through tuning step sizes (see tuning_steps).
  * - Holding for 1s enters S_DFE.
+ * - Holding for 3s en/disables split operation.
+ * - Holding for 5s moves to S_CHANNEL, to recall or store a channel memory.
+ * - Holding for 8s dumps the input trace (compile with OPT_INPUT_TRACE).
  *
  * Keyer:
  * - Pressing moves to S_MEM_SEND_WAIT, to transmit a message memory.
@@ -250,9 +423,11 @@ void loop(void)
  *
  * RIT:
  * - Pressing en/disables RIT.
- * - Holding for 2s moves to S_CHANGE_BAND.
- * - Holding for 5s enters the calibration routine (S_CALIBRATION_CORRECTION).
- * - Holding for 8s erases the EEPROM settings (compile with OPT_ERASE_EEPROM).
+ * - Holding for 1s swaps VFO A and B.
+ * - Holding for 2s moves to S_ADJUST_CS.
+ * - Holding for 5s moves to S_CHANGE_BAND.
+ * - Holding for 8s enters the calibration routine (S_CALIBRATION_CORRECTION).
+ * - Holding for 11s erases the EEPROM settings (compile with OPT_ERASE_EEPROM).
  */
 void loop_default(void)
 {
@@ -265,27 +440,43 @@ void loop_default(void)
     freq_adjust(tuning_steps[state.tuning_step]);
   } else if (rotated_down()) {
     freq_adjust(-tuning_steps[state.tuning_step]);
-  } else if (state.inputs.encoder_button) {
-    duration = time_encoder_button();
-    if (duration > 1000) {
-      if (state.key.mode == KEY_IAMBIC) {
-        if (state.rit) {
-          state.rit = 0;
-          state.op_freq = state.rit_tx_freq;
-          invalidate_frequencies();
-        }
-        state.state = S_DFE;
-        setup_dfe();
-      } else {
-        morse(MX);
+  } else if ((duration = time_encoder_button()) != 0) {
+    if (duration >
+#ifdef OPT_INPUT_TRACE
+        11000
+#else
+        8000
+#endif
+        ) {
+      /* do nothing */
+      invalidate_display();
+    } else
+#ifdef OPT_INPUT_TRACE
+    if (duration > 8000) {
+      trace_dump();
+      invalidate_display();
+    } else
+#endif
+    if (duration > 5000) {
+      state.state = S_CHANNEL;
+      invalidate_display();
+    } else if (duration > 3000) {
+      vfo_toggle_split();
+      invalidate_display();
+    } else if (duration > 1000) {
+      if (state.rit) {
+        state.rit = 0;
+        state.op_freq = state.rit_tx_freq;
+        invalidate_frequencies();
       }
+      state.state = S_DFE;
+      setup_dfe();
       invalidate_display();
     } else if (duration > 50) {
       rotate_tuning_steps();
     }
   // Keyer switch for memory and code speed
-  } else if (state.inputs.keyer) {
-    duration = time_keyer();
+  } else if ((duration = time_keyer()) != 0) {
     if (duration > 8000) {
       /* do nothing */
       invalidate_display();
@@ -299,11 +490,11 @@ void loop_default(void)
     } else if (duration > 50) {
       state.state = S_MEM_SEND_WAIT;
       memory_index_character = 0xff;
+      straight_decoder_reset();
       invalidate_display();
     }
   // RIT switch for RIT, changing band, calibration and erasing EEPROM
-  } else if (state.inputs.rit) {
-    duration = time_rit();
+  } else if ((duration = time_rit()) != 0) {
     if (duration >
 #ifdef OPT_ERASE_EEPROM
         14000
@@ -316,18 +507,11 @@ void loop_default(void)
     } else
 #ifdef OPT_ERASE_EEPROM
     if (duration > 11000) {
-      if (confirm("Erase EEPROM?"))
-        ee_erase();
-      invalidate_display();
+      confirm("Erase EEPROM?", ee_erase);
     } else
 #endif
     if (duration > 8000) {
-      if (confirm("Calibrate?")) {
-        state.state = S_CALIBRATION_CORRECTION;
-        calibration_set_correction();
-        enable_rx_tx(RX_OFF_TX_ON);
-      }
-      invalidate_display();
+      confirm("Calibrate?", confirm_calibrate);
     } else if (duration > 5000) {
       state.state = S_CHANGE_BAND;
       if (state.rit) {
@@ -340,7 +524,12 @@ void loop_default(void)
     } else if (duration > 2000) {
       state.state = S_ADJUST_CS;
       invalidate_display();
+    } else if (duration > 1000) {
+      vfo_swap();
+      invalidate_display();
     } else if (duration > 50) {
+      if (state.split)
+        vfo_toggle_split();
       if (state.rit) {
         state.rit = 0;
         state.op_freq = state.rit_tx_freq;
@@ -358,21 +547,43 @@ void loop_default(void)
 
 /**
  * Loop for the S_KEYING state. In this state, buttons are disabled, and the
- * keying routing for paddle or straight key is called.
+ * keying routine for paddle or straight key is called. When the character has
+ * been keyed or the straight key is released, we return to S_DEFAULT.
  */
 void loop_keying(void)
 {
-  if (state.key.mode == KEY_IAMBIC) {
+  if (state.key.mode == KEY_IAMBIC)
     iambic_key();
-  } else if (digitalRead(DOTin) == LOW) {
+  else
     straight_key();
+
+  if (!state.key.busy)
     state.state = S_DEFAULT;
-  }
 }
 
+/**
+ * Keying in the states where characters are decoded rather than transmitted:
+ * S_DFE, S_MEM_ENTER, S_MEM_SEND_WAIT and S_CALL_ENTER. The characters are
+ * passed to key_handle_end() and key_handle_decoded().
+ */
+void loop_key_decode(void)
+{
+  if (state.key.mode == KEY_STRAIGHT)
+    straight_key_decode();
+  else
+    iambic_key();
+}
+
+/**
+ * The time at which the key speed was last adjusted with the paddle in
+ * S_ADJUST_CS.
+ */
+unsigned long adjust_cs_time;
+
 /**
  * Loop for the S_ADJUST_CS state. In this state, the key speed can be changed
- * using the rotary encoder and/or paddle.
+ * using the rotary encoder and/or paddle. While the paddle is held, the speed
+ * is adjusted every 200ms.
  * The keyer switch selects the speed and returns to S_DEFAULT.
  */
 void loop_adjust_cs(void)
@@ -381,18 +592,19 @@ void loop_adjust_cs(void)
     adjust_cs(1);
   } else if (rotated_down()) {
     adjust_cs(-1);
-  } else if (state.key.mode == KEY_IAMBIC && !digitalRead(DASHin)) {
-    adjust_cs(1);
-    delay(200);
-  } else if (state.key.mode == KEY_IAMBIC && !digitalRead(DOTin)) {
-    adjust_cs(-1);
-    delay(200);
-  } else if (state.inputs.keyer) {
+  } else if (state.key.mode == KEY_IAMBIC && key_active()) {
+    unsigned long elapsed = tcount - adjust_cs_time;
+    if (elapsed >= 200) {
+      adjust_cs(digitalRead(DASHin) == LOW ? 1 : -1);
+      adjust_cs_time = tcount;
+      elapsed = 0;
+    }
+    task_post_in(TASK_INPUT, 200 - elapsed);
+  } else if (button_pressed(BUTTON_KEYER)) {
     state.state = S_DEFAULT;
     load_cw_speed();
     store_cw_speed();
     invalidate_display();
-    debounce_keyer();
   }
 }
 
@@ -402,13 +614,11 @@ void loop_adjust_cs(void)
  */
 void loop_tune(void)
 {
-  if (state.inputs.rit) {
-    debounce_rit();
+  if (button_pressed(BUTTON_RIT)) {
     straight_key_handle_disable();
     state.state = S_DEFAULT;
     invalidate_display();
-  } else if (state.inputs.keyer) {
-    debounce_keyer();
+  } else if (button_pressed(BUTTON_KEYER)) {
     state.tune_mode_on = ~state.tune_mode_on;
     if (state.tune_mode_on)
       straight_key_handle_enable();
@@ -445,7 +655,7 @@ void loop_change_band(void)
   } else if (rotated_down()) {
     nextband(-1);
     invalidate_display();
-  } else if (state.inputs.keyer) {
+  } else if (button_pressed(BUTTON_KEYER)) {
     store_band();
 
     if (state.state == S_CALIBRATION_CHANGE_BAND) {
@@ -457,7 +667,6 @@ void loop_change_band(void)
     }
 
     invalidate_display();
-    debounce_keyer();
   }
 }
 
@@ -471,8 +680,11 @@ void loop_change_band(void)
 void setup_dfe(void)
 {
   unsigned long power;
+  unsigned long low = band_limit_low(state.band);
+  unsigned long high = band_limit_high(state.band);
   dfe_character = 0xff;
   dfe_freq = 0;
+  straight_decoder_reset();
 
   if (state.band == BAND_10) {
     dfe_position = 4;
@@ -482,9 +694,9 @@ void setup_dfe(void)
     power = 10000000;
   }
 
-  while ((BAND_LIMITS_LOW[state.band] / power) * power == (BAND_LIMITS_HIGH[state.band] / power) * power) {
+  while ((low / power) * power == (high / power) * power) {
     dfe_position--;
-    dfe_freq += (((BAND_LIMITS_LOW[state.band] / power) % 10) * power) / 10000;
+    dfe_freq += (((low / power) % 10) * power) / 10000;
     power /= 10;
   }
 }
@@ -498,39 +710,17 @@ void setup_dfe(void)
  * detected, a question mark is sounded on the sidetone.
  * The RIT switch cancels the DFE and returns to S_DEFAULT.
  * The keyer switch sets the remaining digits to 0 and returns to S_DEFAULT.
+ * The characters are keyed in the keying task (see loop_key_decode()).
  */
 void loop_dfe(void)
 {
   if (dfe_character != 0xff) {
-    unsigned long add;
-    switch (dfe_character) {
-      case M0: case MT: add = 0; break;
-#ifdef OPT_OBSCURE_MORSE_ABBREVIATIONS
-      case M1: case MA: add = 1; break;
-      case M2: case MU: add = 2; break;
-      case M3: case MW: add = 3; break;
-      case M4: case MV: add = 4; break;
-      case M5: case MS: add = 5; break;
-      case M6: case MB: add = 6; break;
-      case M7: case MG: add = 7; break;
-      case M8: case MD: add = 8; break;
-#else
-      case M1: add = 1; break;
-      case M2: add = 2; break;
-      case M3: add = 3; break;
-      case M4: add = 4; break;
-      case M5: add = 5; break;
-      case M6: add = 6; break;
-      case M7: add = 7; break;
-      case M8: add = 8; break;
-#endif
-      case M9: case MN: add = 9; break;
-      default:
-        morse(Mquestion);
-        dfe_character = 0xff;
-        return;
-    }
+    unsigned long add = morse_digit(dfe_character);
     dfe_character = 0xff;
+    if (add == 0xff) {
+      morse(Mquestion);
+      return;
+    }
 
     for (byte i = 0; i < dfe_position; i++)
       add *= 10;
@@ -542,18 +732,14 @@ void loop_dfe(void)
     }
 
     invalidate_display();
-  } else if (state.inputs.keyer) {
+  } else if (button_pressed(BUTTON_KEYER)) {
     bool success = set_dfe();
     invalidate_display();
     morse(success ? MR : MF);
-    debounce_keyer();
-  } else if (state.inputs.rit) {
+  } else if (button_pressed(BUTTON_RIT)) {
     state.state = S_DEFAULT;
     invalidate_display();
     morse(MX);
-    debounce_rit();
-  } else if (key_active()) {
-    iambic_key();
   }
 }
 
@@ -565,9 +751,9 @@ void loop_dfe(void)
 bool set_dfe(void)
 {
   if (state.band == BAND_10)
-    state.op_freq = (BAND_LIMITS_LOW[state.band] / 1000000000u) * 1000000000u;
+    state.op_freq = (band_limit_low(state.band) / 1000000000u) * 1000000000u;
   else
-    state.op_freq = (BAND_LIMITS_LOW[state.band] / 100000000) * 100000000;
+    state.op_freq = (band_limit_low(state.band) / 100000000) * 100000000;
   state.op_freq += dfe_freq * 10000;
 
   unsigned long tried_op_freq = state.op_freq;
@@ -578,58 +764,101 @@ bool set_dfe(void)
   return tried_op_freq == state.op_freq;
 }
 
+/**
+ * Loop for the S_CHANNEL state. In this state, the user can select one of the
+ * channel memories with the rotary encoder.
+ * The keyer switch recalls the channel to the active VFO and returns to
+ * S_DEFAULT. When the channel is empty or in another band, a question mark is
+ * sounded on the sidetone.
+ * The encoder button stores the frequency of the active VFO in the channel and
+ * returns to S_DEFAULT.
+ * The RIT switch returns to S_DEFAULT.
+ */
+void loop_channel(void)
+{
+  if (rotated_up()) {
+    channel_index++;
+    channel_index %= CHANNEL_COUNT;
+    invalidate_display();
+  } else if (rotated_down()) {
+    channel_index--;
+    if (channel_index == 0xff)
+      channel_index = CHANNEL_COUNT - 1;
+    invalidate_display();
+  } else if (button_pressed(BUTTON_KEYER)) {
+    bool success = channel_recall(channel_index);
+    state.state = S_DEFAULT;
+    invalidate_display();
+    if (!success)
+      morse(Mquestion);
+  } else if (button_pressed(BUTTON_ENCODER)) {
+    channel_store(channel_index);
+    state.state = S_DEFAULT;
+    invalidate_display();
+    morse(MR);
+  } else if (button_pressed(BUTTON_RIT)) {
+    state.state = S_DEFAULT;
+    invalidate_display();
+    morse(MX);
+  }
+}
+
 /**
  * Loop for the S_MEM_ENTER_WAIT state. In this state, the user can start
  * entering a new message memory.
- * When this state is entered with a straight key, the system returns to
- * S_DEFAULT state, since CW detection is not implemented for straight keys.
- * The keyer switch returns to the S_DEFAULT state.
- * The paddle moves on to the S_MEM_ENTER state.
+ * The RIT switch returns to the S_DEFAULT state.
+ * The paddle or straight key moves on to the S_MEM_ENTER state.
  */
 void loop_mem_enter_wait(void)
 {
-  memory_pointer = 0;
-
-  if (state.inputs.rit || state.key.mode != KEY_IAMBIC) {
+  if (button_pressed(BUTTON_RIT)) {
     state.state = S_DEFAULT;
     invalidate_display();
     morse(MX);
-    debounce_keyer();
   } else if (key_active()) {
     state.state = S_MEM_ENTER;
+    memory_record_start();
+    straight_decoder_reset();
   }
 }
 
 /**
- * Timer variable for loop_mem_enter(), keeping track of how long the key has
- * been inactive in order to insert word breaks.
+ * Timer variable for loop_mem_enter() and loop_mem_send_wait(), keeping track
+ * of how long the key has been inactive in order to insert word breaks or to
+ * start transmitting the queued memories. It is set by key_handle_end().
  */
 unsigned long quiet_since;
 
+/**
+ * The number of dot times that remain of the wait between transmissions in
+ * beacon mode, see loop_mem_send_tx().
+ */
+byte beacon_wait;
+
 /**
  * Loop for the S_MEM_ENTER state. In this state, the user is keying in a new
  * message memory.
  * The keyer switch moves on to the S_MEM_ENTER_REVIEW state and plays the
- * recorded message to the user.
- * When the paddle is used, the new character is recorded.
+ * recorded message to the user. This also happens when the memory is full.
+ * When the paddle is used, the new character is recorded (see
+ * memory_record_add()).
  * When the paddle has not been used for 3 * the dash time, a word break is
  * recorded. No consecutive word breaks are recorded.
+ * With a straight key, characters and word breaks are detected by
+ * straight_key_decode() (see loop_key_decode()).
  */
 void loop_mem_enter(void)
 {
-  if (state.inputs.keyer) {
+  if (button_pressed(BUTTON_KEYER) || memory_record_full()) {
     state.state = S_MEM_ENTER_REVIEW;
     invalidate_display();
-    playback_buffer();
-  } else if (key_active()) {
-    iambic_key();
-    quiet_since = tcount;
-  } else if (quiet_since != 0
-      && tcount - quiet_since > 3 * state.key.dash_time
-      && buffer[memory_pointer-1] != 0x00) {
-    buffer[memory_pointer++] = 0x00;
-    buffer[memory_pointer] = 0xff;
-    display_flash_circle(1);
+    memory_record_playback();
+  } else if (state.key.mode == KEY_IAMBIC && quiet_since != 0 && !key_active()) {
+    unsigned long quiet = tcount - quiet_since;
+    if (quiet <= 3 * state.key.dash_time)
+      task_post_in(TASK_INPUT, 3 * state.key.dash_time + 1 - quiet);
+    else if (memory_record_break())
+      display_flash_circle(1);
   }
 }
 
@@ -651,8 +880,8 @@ void loop_mem_enter_review(void)
     if (memory_index == 0xff)
       memory_index = 9;
     invalidate_display();
-  } else if (state.inputs.keyer) {
-    store_memory(memory_index);
+  } else if (button_pressed(BUTTON_KEYER)) {
+    memory_record_commit(memory_index);
     morse(MM);
     if (memory_index + 1 >= 10)
       morse(MORSE_DIGITS[(memory_index + 1) / 10]);
@@ -660,22 +889,23 @@ void loop_mem_enter_review(void)
     memory_index = 0;
     state.state = S_DEFAULT;
     invalidate_display();
-    debounce_keyer();
-  } else if (state.inputs.rit) {
+  } else if (button_pressed(BUTTON_RIT)) {
     state.state = S_MEM_ENTER_WAIT;
-    memory_pointer = 0;
     invalidate_display();
-    debounce_rit();
   }
 }
 
 /**
  * Loop for the S_MEM_SEND_WAIT state. In this state, the user can choose the
- * memory to send. Picking a memory moves to the S_MEM_SEND_TX state, transmits
- * the memory and returns to S_DEFAULT.  The RIT switch returns to the
- * S_DEFAULT state.
+ * memories to send. Picking memories moves to the S_MEM_SEND_TX state,
+ * transmits the memories and returns to S_DEFAULT.  The RIT switch returns to
+ * the S_DEFAULT state.
  * One of ten memories can be selected using the rotary encoder: turn to
  * select, then transmit with the keyer switch.
+ * Memories can also be selected by keying their numbers, which are added to
+ * the queue (see memory_queue_add()). When the key has been inactive for 3 *
+ * the dash time, the queued memories are transmitted back to back.
+ * The encoder button moves to S_CALL_ENTER, to enter a callsign for TOKEN_CALL.
  */
 void loop_mem_send_wait(void)
 {
@@ -688,127 +918,250 @@ void loop_mem_send_wait(void)
     if (memory_index == 0xff)
       memory_index = 9;
     invalidate_display();
-  } else if (state.inputs.keyer) {
-    debounce_keyer();
-    state.state = S_MEM_SEND_TX;
-    load_memory_for_tx(memory_index);
+  } else if (button_pressed(BUTTON_KEYER)) {
+    if (!memory_queue_length())
+      memory_queue_add(memory_index);
+    start_memory_queue();
+  } else if (button_pressed(BUTTON_ENCODER)) {
+    memory_queue_clear();
+    state.state = S_CALL_ENTER;
+    call_character = 0xff;
+    callsign_clear();
+    straight_decoder_reset();
     invalidate_display();
-  } else if (key_active()) {
-    iambic_key();
   } else if (memory_index_character != 0xff) {
-    switch (memory_index_character) {
-      case M0: case MT: memory_index = 0; break;
-#ifdef OPT_OBSCURE_MORSE_ABBREVIATIONS
-      case M1: case MA: memory_index = 1; break;
-      case M2: case MU: memory_index = 2; break;
-      case M3: case MW: memory_index = 3; break;
-      case M4: case MV: memory_index = 4; break;
-      case M5: case MS: memory_index = 5; break;
-      case M6: case MB: memory_index = 6; break;
-      case M7: case MG: memory_index = 7; break;
-      case M8: case MD: memory_index = 8; break;
-#else
-      case M1: memory_index = 1; break;
-      case M2: memory_index = 2; break;
-      case M3: memory_index = 3; break;
-      case M4: memory_index = 4; break;
-      case M5: memory_index = 5; break;
-      case M6: memory_index = 6; break;
-      case M7: memory_index = 7; break;
-      case M8: memory_index = 8; break;
-#endif
-      case M9: case MN: memory_index = 9; break;
-      default:
-        morse(Mquestion);
-        memory_index_character = 0xff;
-        break;
-    }
+    byte index = morse_digit(memory_index_character);
+    memory_index_character = 0xff;
 
-    if (memory_index_character != 0xff) {
-      invalidate_display();
-      state.state = S_MEM_SEND_TX;
-      load_memory_for_tx(memory_index);
+    if (index == 0xff || !memory_queue_add(index)) {
+      morse(Mquestion);
+    } else {
+      memory_index = index;
       invalidate_display();
-      memory_index_character = 0xff;
     }
-  } else if (state.inputs.rit) {
+  } else if (button_pressed(BUTTON_RIT)) {
+    memory_queue_clear();
     state.state = S_DEFAULT;
     invalidate_display();
-    debounce_rit();
+  } else if (memory_queue_length() && !key_active()) {
+    unsigned long quiet = tcount - quiet_since;
+    if (quiet > 3 * state.key.dash_time)
+      start_memory_queue();
+    else
+      task_post_in(TASK_INPUT, 3 * state.key.dash_time + 1 - quiet);
   }
 }
 
 /**
- * Loop for the S_MEM_SEND_TX state. In this state, on every iteration, the
- * next character of the buffer is transmitted.
- * At the end, we return to S_DEFAULT, unless we are in beacon mode. In beacon
- * mode, we wait for a time defined by BEACON_INTERVAL, and then repeat.
- * The keyer switch toggles beacon mode on and off. The RIT switch ends any
- * active transmission.
+ * Move to S_MEM_SEND_TX to transmit the first memory in the queue.
  */
-void loop_mem_send_tx(void)
+void start_memory_queue(void)
+{
+  memory_index = memory_queue_next();
+  memory_tx_start(memory_index);
+  state.state = S_MEM_SEND_TX;
+  invalidate_display();
+  task_post(TASK_KEYING);
+}
+
+/**
+ * Loop for the S_CALL_ENTER state. In this state, the user keys in the
+ * callsign that is sent for TOKEN_CALL in memories. The rotary encoder adjusts
+ * the serial number that is sent for TOKEN_SERIAL.
+ * The keyer switch returns to S_MEM_SEND_WAIT, to select a memory to transmit.
+ * The RIT switch returns to S_DEFAULT.
+ * The characters are keyed in the keying task (see loop_key_decode()).
+ */
+void loop_call_enter(void)
 {
-  if (state.inputs.keyer) {
-    state.beacon = ~state.beacon;
+  if (call_character != 0xff) {
+    callsign_add(call_character);
+    call_character = 0xff;
+    invalidate_display();
+  } else if (rotated_up()) {
+    serial_adjust(1);
+    invalidate_display();
+  } else if (rotated_down()) {
+    serial_adjust(-1);
     invalidate_display();
-    debounce_keyer();
-  } else if (state.inputs.rit) {
+  } else if (button_pressed(BUTTON_KEYER)) {
+    state.state = S_MEM_SEND_WAIT;
+    memory_index_character = 0xff;
+    straight_decoder_reset();
+    invalidate_display();
+  } else if (button_pressed(BUTTON_RIT)) {
     state.state = S_DEFAULT;
     invalidate_display();
-    debounce_rit();
-  } else {
-    byte character = buffer[state.mem_tx_index];
+  }
+}
+
+/**
+ * Loop for the S_MEM_SEND_TX state, run by the keying task. In this state, the
+ * next character of the memory is transmitted (see memory_tx_next()) whenever
+ * the previous one has been sent (see morse_send()).
+ * At the end, the next memory in the queue is transmitted after a word space.
+ * When the queue is empty, we return to S_DEFAULT, unless we are in beacon
+ * mode. In beacon mode, we wait for a time defined by BEACON_INTERVAL, and
+ * then repeat the last memory.
+ * The paddle or straight key ends the transmission immediately, even within
+ * an element, and moves to S_KEYING (break-in). For the buttons, see
+ * loop_mem_send_tx_buttons().
+ */
+void loop_mem_send_tx(void)
+{
+  if (key_active()) {
+    memory_break_in();
+    return;
+  }
+
+  if (!beacon_wait) {
+    byte character = memory_tx_next();
     switch (character) {
       case 0xff:
-        state.mem_tx_index = 0;
-        if (!state.beacon) {
+        memory_tx_end();
+        if (memory_queue_length()) {
+          /* morse_send() ended with 4 dot times of space; make it a word space.
+           * The pause starts before start_memory_queue() updates the display,
+           * so that the display does not lengthen it. */
+          morse_pause(3 * state.key.dot_time, 1);
+          start_memory_queue();
+        } else if (!state.beacon) {
           memory_index = 0;
           state.state = S_DEFAULT;
           invalidate_display();
         } else {
-          for (byte i = 0; i < BEACON_INTERVAL; i++) {
-            display_progress(0, BEACON_INTERVAL - 1, i);
-            delay(state.key.dot_time);
-            if (state.inputs.keyer || state.inputs.rit) {
-              if (state.inputs.keyer)
-                state.beacon = 0;
-              memory_index = 0;
-              state.state = S_DEFAULT;
-              invalidate_display();
-              debounce_keyer();
-              debounce_rit();
-              break;
-            }
-          }
+          memory_tx_repeat(memory_index);
+          beacon_wait = BEACON_INTERVAL;
         }
         break;
       case 0x00:
-        delay(7 * state.key.dot_time);
-        state.mem_tx_index++;
+        morse_pause(7 * state.key.dot_time, 1);
         break;
       default:
-        key_handle_start();
-        morse(character);
-        key_handle_end();
-        state.mem_tx_index++;
+        morse_send(character, 1);
         break;
     }
   }
+
+  if (beacon_wait) {
+    display_progress(0, BEACON_INTERVAL - 1, BEACON_INTERVAL - beacon_wait);
+    beacon_wait--;
+    morse_pause(state.key.dot_time, 1);
+  }
+}
+
+/**
+ * The buttons in the S_MEM_SEND_TX state, handled by the input task.
+ * The keyer switch toggles beacon mode on and off. The RIT switch ends any
+ * active transmission. While waiting in beacon mode, both switches return to
+ * S_DEFAULT; the keyer switch also turns off beacon mode.
+ */
+void loop_mem_send_tx_buttons(void)
+{
+  if (button_pressed(BUTTON_KEYER)) {
+    if (beacon_wait) {
+      state.beacon = 0;
+      memory_send_stop();
+    } else {
+      state.beacon = ~state.beacon;
+      invalidate_display();
+    }
+  } else if (button_pressed(BUTTON_RIT)) {
+    memory_send_stop();
+  }
+}
+
+/**
+ * Stop transmitting memories and return to S_DEFAULT.
+ */
+void memory_send_stop(void)
+{
+  morse_stop();
+  memory_tx_cancel();
+  memory_queue_clear();
+  memory_index = 0;
+  beacon_wait = 0;
+  state.state = S_DEFAULT;
+  invalidate_display();
+}
+
+/**
+ * Stop transmitting memories because the paddle or straight key was touched,
+ * and hand over to S_KEYING.
+ */
+void memory_break_in(void)
+{
+  memory_tx_cancel();
+  memory_queue_clear();
+  memory_index = 0;
+  beacon_wait = 0;
+  state.state = S_KEYING;
+  invalidate_display();
+  task_post(TASK_KEYING);
 }
 
+/**
+ * The frequency of the alarm in S_ERROR (0 between alarms), and the time at
+ * which it was set, see loop_error().
+ */
+unsigned int error_tone;
+unsigned long error_tone_time;
+
 /**
  * Loop for the S_ERROR state. In this state, an alarm is sounded on the
- * sidetone. There is no recovery from this state except for turning off the
+ * sidetone: a sweep from 400 to 1000Hz in steps of 10ms. With OPT_WATCHDOG,
+ * the watchdog is then left to reset the device, which resumes from the last
+ * snapshot and reports the error. Without it, the alarm is repeated after
+ * 450ms, and there is no recovery from this state except for turning off the
  * device.
  */
 void loop_error(void)
 {
-  for (unsigned int f = 400; f < 1000; f += 10) {
-    tone(SIDETONE, f);
-    delay(10);
+  unsigned long elapsed = tcount - error_tone_time;
+
+  if (!error_tone) {
+#ifdef OPT_WATCHDOG
+    return; /* loop() does not feed the watchdog in S_ERROR */
+#else
+    if (elapsed < 450) {
+      task_post_in(TASK_INPUT, 450 - elapsed);
+      return;
+    }
+    error_tone = 400;
+#endif
+  } else if (elapsed < 10) {
+    task_post_in(TASK_INPUT, 10 - elapsed);
+    return;
+  }
+
+  watchdog_feed();
+  error_tone_time = tcount;
+  if (error_tone < 1000) {
+    tone(SIDETONE, error_tone);
+    error_tone += 10;
+    task_post_in(TASK_INPUT, 10);
+  } else {
+    noTone(SIDETONE);
+    error_tone = 0;
+#ifndef OPT_WATCHDOG
+    task_post_in(TASK_INPUT, 450);
+#endif
+  }
+}
+
+/**
+ * Loop for the S_CONFIRM state, see confirm().
+ */
+void loop_confirm(void)
+{
+  if (button_pressed(BUTTON_KEYER)) {
+    state.state = S_DEFAULT;
+    invalidate_display();
+    confirm_action();
+  } else if (button_pressed(BUTTON_RIT)) {
+    state.state = S_DEFAULT;
+    invalidate_display();
   }
-  noTone(SIDETONE);
-  delay(450);
 }
 
 /**
@@ -820,7 +1173,7 @@ void loop_error(void)
  */
 void loop_calibration_correction(void)
 {
-  if (state.inputs.keyer) {
+  if (button_pressed(BUTTON_KEYER)) {
     EEPROM.write(EEPROM_CAL_VALUE + 0, cal_value);
     EEPROM.write(EEPROM_CAL_VALUE + 1, cal_value >> 8);
     EEPROM.write(EEPROM_CAL_VALUE + 2, cal_value >> 16);
@@ -831,8 +1184,6 @@ void loop_calibration_correction(void)
     invalidate_frequencies();
     invalidate_display();
     enable_rx_tx(RX_ON_TX_OFF);
-
-    debounce_keyer();
   } else if (rotated_up()) {
     cal_value -= 100;
     calibration_set_correction();
@@ -850,7 +1201,7 @@ void loop_calibration_correction(void)
  */
 void loop_calibration_peak_if(void)
 {
-  if (state.inputs.keyer) {
+  if (button_pressed(BUTTON_KEYER)) {
     IFfreq = state.op_freq;
     EEPROM.write(EEPROM_IF_FREQ + 0, state.op_freq);
     EEPROM.write(EEPROM_IF_FREQ + 1, state.op_freq >> 8);
@@ -860,8 +1211,6 @@ void loop_calibration_peak_if(void)
     nextband(0);
     invalidate_frequencies();
     invalidate_display();
-
-    debounce_keyer();
   } else if (rotated_up()) {
     state.op_freq += 1000;
     invalidate_frequencies();
@@ -880,12 +1229,11 @@ void loop_calibration_peak_if(void)
  */
 void loop_calibration_peak_rx(void)
 {
-  if (state.inputs.keyer) {
+  if (button_pressed(BUTTON_KEYER)) {
     state.state = S_DEFAULT;
     setup_band();
     enable_rx_tx(RX_ON_TX_OFF);
     invalidate_display();
-    debounce_keyer();
   }
 }
 
@@ -906,59 +1254,144 @@ void rotate_tuning_steps(void)
  */
 byte morse_char;
 
+/**
+ * The end of the last character keyed in S_KEYING, to detect word breaks for
+ * the echo on the display.
+ */
+unsigned long echo_quiet_since;
+
 /**
  * Handle the start of a morse character. This enables mute. When in TX mode,
  * the RX clock is disabled and the TX is enabled. The detected character is
  * reset.
+ * When the key has been inactive for 3 * the dash time, a word break is added
+ * to the echo on the display (like in loop_mem_enter()).
  * Also see key_handle_end();
  */
 void key_handle_start(void)
 {
   morse_char = 0x01;
+
+  if (state.state == S_KEYING && tcount - echo_quiet_since > 3 * state.key.dash_time)
+    display_echo(' ');
 }
 
 /**
  * Handle the end of a morse character. This disables mute, enables RX and
- * disables TX. In MEM_ENTER mode, the detected character is stored.
+ * disables TX. In S_KEYING, the detected character is echoed on the display.
+ * In MEM_ENTER mode, the detected character is stored. In the other states,
+ * the character is handled by the input task, which is posted.
  * Also see key_handle_start().
  */
 void key_handle_end(void)
 {
+  task_post(TASK_INPUT);
+
   if (state.state == S_KEYING) {
+    display_echo(morse_to_ascii(morse_char));
+    echo_quiet_since = tcount;
     state.state = S_DEFAULT;
   } else if (state.state == S_MEM_ENTER) {
-    if (memory_pointer == MEMORY_LENGTH) {
-      error(2);
-      return;
-    }
-    buffer[memory_pointer++] = morse_char;
-    buffer[memory_pointer] = 0xff;
-    display_flash_circle(0);
+    if (memory_record_add(morse_char))
+      display_flash_circle(0);
+    quiet_since = tcount;
   } else if (state.state == S_DFE) {
     dfe_character = morse_char;
   } else if (state.state == S_MEM_SEND_WAIT) {
     memory_index_character = morse_char;
+    quiet_since = tcount;
+  } else if (state.state == S_CALL_ENTER) {
+    call_character = morse_char;
+  }
+}
+
+/**
+ * Handle a character decoded from the straight key (see
+ * straight_key_decode()). Characters are handled as if they were keyed with
+ * the paddle. A word break (0x00) is recorded in MEM_ENTER mode.
+ */
+void key_handle_decoded(byte character)
+{
+  if (character != 0x00) {
+    morse_char = character;
+    key_handle_end();
+  } else if (state.state == S_MEM_ENTER && memory_record_break()) {
+    display_flash_circle(1);
   }
 }
 
 /**
- * Handle a dash. In TX modes, this will enable TXEN. In other cases, the
- * detected character is updated. The sidetone will be enabled.
+ * Set the semi-break-in hang timer, which is counted down by key_isr(). A time
+ * of 0 stops the timer.
+ */
+static void hang_set(unsigned int time)
+{
+  noInterrupts();
+  state.key.hang = time;
+  state.key.hang_expired = 0;
+  interrupts();
+}
+
+/**
+ * Enable RX again when the semi-break-in hang timer has expired (see
+ * HANG_TIME). This should be called regularly outside keying.
+ */
+void hang_poll(void)
+{
+  if (state.key.hang_expired) {
+    enable_rx_tx(RX_ON_TX_OFF);
+    digitalWrite(MUTE, HIGH);
+  }
+}
+
+/**
+ * Start transmitting an element. The RX clock is disabled and the TX clock is
+ * enabled, unless this was already done for a previous element within the
+ * semi-break-in hang time: then only TXEN is switched.
  * A 1ms delay is included between enabling the clock and switching on +12V TX to 
  * ensure clock is running before DC is applied to the PA.
+ * Also see tx_element_end().
+ */
+static void tx_element_start(void)
+{
+  hang_set(0);
+  if (!state.key.tx) {
+    enable_rx_tx(RX_OFF_TX_ON);
+    state.key.tx = 1;
+    delay(1);
+  }
+  digitalWrite(TXEN, HIGH);
+  trace_tx(1);
+}
+
+/**
+ * End an element. Only TXEN is switched off and the hang timer is started; the
+ * RX clock is enabled by hang_poll() when it expires. With semi-break-in, this
+ * is after HANG_TIME. With full QSK (HANG_TIME 0), it is after 5ms, to ensure
+ * that the anti key-click tail is completed before the clock is switched off.
+ * Also see tx_element_start().
+ */
+static void tx_element_end(void)
+{
+  digitalWrite(TXEN, LOW);
+  if (state.key.tx)
+    trace_tx(0);
+  hang_set(HANG_TIME > 0 && state.key.tx ? HANG_TIME : 5);
+}
+
+/**
+ * Handle a dash. In TX modes, this will start transmitting (see
+ * tx_element_start()). The detected character is updated and the sidetone
+ * will be enabled.
  * Also see key_handle_dot() and key_handle_dashdot_end().
  */
 void key_handle_dash(void)
 {
   digitalWrite(MUTE, LOW);
   SIDETONE_ENABLE();
-  if (state.state == S_KEYING || state.state == S_MEM_SEND_TX) {
-    enable_rx_tx(RX_OFF_TX_ON);
-    delay(1);
-    digitalWrite(TXEN, HIGH);
-  } else {
-    morse_char = (morse_char << 1) | 0x01;
-  }
+  morse_char = (morse_char << 1) | 0x01;
+  if (state.state == S_KEYING || state.state == S_MEM_SEND_TX)
+    tx_element_start();
 }
 
 /**
@@ -968,28 +1401,19 @@ void key_handle_dot(void)
 {
   digitalWrite(MUTE, LOW);
   SIDETONE_ENABLE();
-  if (state.state == S_KEYING || state.state == S_MEM_SEND_TX) {
-    enable_rx_tx(RX_OFF_TX_ON);
-    delay(1);
-    digitalWrite(TXEN, HIGH);
-  } else {
-    morse_char <<= 1;
-  }
+  morse_char <<= 1;
+  if (state.state == S_KEYING || state.state == S_MEM_SEND_TX)
+    tx_element_start();
 }
 
 /**
- * Handle the end of a dash or dot.
- * A 5ms delay is included between switching off the +12V TX and switching off the clock to 
- * ensure anti key-click tail is completed.
+ * Handle the end of a dash or dot (see tx_element_end()).
  * See key_handle_dash() and key_handle_dot().
  */
 void key_handle_dashdot_end(void)
 {
   SIDETONE_DISABLE();
-  digitalWrite(TXEN, LOW);
-  delay(5);
-  enable_rx_tx(RX_ON_TX_OFF);
-  digitalWrite(MUTE, HIGH);
+  tx_element_end();
 }
 
 /**
@@ -1001,9 +1425,7 @@ void straight_key_handle_enable(void)
 {
   SIDETONE_ENABLE();
   digitalWrite(MUTE, LOW);
-  enable_rx_tx(RX_OFF_TX_ON);
-  delay(1);
-  digitalWrite(TXEN, HIGH);
+  tx_element_start();
 }
 
 /**
@@ -1011,10 +1433,7 @@ void straight_key_handle_enable(void)
  */
 void straight_key_handle_disable(void)
 {
-  digitalWrite(TXEN, LOW);
-  delay(5);
-  enable_rx_tx(RX_ON_TX_OFF);
-  digitalWrite(MUTE, HIGH);
+  tx_element_end();
   SIDETONE_DISABLE();
 }
 
@@ -1046,12 +1465,14 @@ void fetch_calibration_data(void)
 
 /**
  * Enable/disable the RX and TX clocks. This is faster than
- * Si5351::output_enable().
+ * Si5351::output_enable(). This ends the semi-break-in hang time.
  *
  * @param option one of RX_ON_TX_ON, RX_OFF_TX_ON, RX_ON_TX_OFF, RX_OFF_TX_OFF.
  */
 void enable_rx_tx(byte option)
 {
+  hang_set(0);
+  state.key.tx = 0;
   Wire.beginTransmission(0x60);
   Wire.write(3);
   Wire.write(option);
@@ -1073,26 +1494,11 @@ void freq_adjust(long step)
 }
 
 /**
- * Fix the operating frequency between the band limits.
+ * Fix the operating frequency within the band plan (see band_fix_freq()).
  */
 void fix_op_freq(long step)
 {
-#ifdef PLAN_VK
-  if (state.band == BAND_80) {
-    if (state.op_freq > BAND_80_LOW_TOP && state.op_freq < BAND_80_GAP_MIDDLE){	
-	  state.op_freq = BAND_80_HIGH_BOTTOM;
-	  return;
-	}
-    else if (state.op_freq < BAND_80_HIGH_BOTTOM && state.op_freq > BAND_80_GAP_MIDDLE) {	  
-	  state.op_freq = BAND_80_LOW_TOP;
-	  return;
-	}
-  }
-#endif
-  if (state.op_freq > BAND_LIMITS_HIGH[state.band])
-    state.op_freq = BAND_LIMITS_HIGH[state.band];
-  if (state.op_freq < BAND_LIMITS_LOW[state.band])
-    state.op_freq = BAND_LIMITS_LOW[state.band];
+  state.op_freq = band_fix_freq(state.band, state.op_freq, step);
 
   if (state.rit) {
     /* to prevent the display from overflowing */
@@ -1120,17 +1526,8 @@ void invalidate_frequencies(void)
 
   si5351.set_freq(freq, 0ull, SI5351_CLK_RX);
   si5351.set_freq(TX_FREQ(state), 0ull, SI5351_CLK_TX);
-}
-
-/**
- * Prepare a memory for transmission. This loads the memory, prepares the
- * buffer and resets the character index.
- */
-void load_memory_for_tx(byte index)
-{
-  load_memory(index);
-  prepare_buffer_for_tx();
-  state.mem_tx_index = 0;
+  vfo_invalidate();
+  trace_freq(state.op_freq);
 }
 
 /**
@@ -1151,19 +1548,98 @@ void ee_erase(void)
     EEPROM.write(i, 0xff);
 
   display_feedback("EEPROM erased.");
-  display_delay(1500);
 }
 #endif
 
 /**
- * Enter the error state. This error is non-recoverable and should only be used
- * in very rare cases.
+ * Enter the error state. This error is non-recoverable (except through the
+ * watchdog, see loop_error()) and should only be used in very rare cases.
  */
 void error(byte er)
 {
   errno = er;
+  snapshot.error = er;
+  save_snapshot();
   state.state = S_ERROR;
   invalidate_display();
+  error_tone = 400;
+  error_tone_time = tcount;
+  task_post_in(TASK_INPUT, 10);
+}
+
+/**
+ * Reset the watchdog timer. This should be called from any loop that may
+ * legitimately block for longer than the watchdog timeout. It is deliberately
+ * not called during I2C transactions, so that a hanging bus triggers a reset.
+ */
+void watchdog_feed(void)
+{
+#ifdef OPT_WATCHDOG
+  wdt_reset();
+#endif
+}
+
+/**
+ * Compute the checksum of the snapshot, excluding the checksum itself.
+ */
+byte snapshot_checksum(void)
+{
+  byte *data = (byte*) &snapshot;
+  byte sum = 0xa5;
+  for (byte i = 0; i < offsetof(struct snapshot, checksum); i++)
+    sum = (sum << 1 | sum >> 7) ^ data[i];
+  return sum;
+}
+
+/**
+ * Check whether the snapshot in .noinit contains valid data.
+ */
+byte snapshot_valid(void)
+{
+  return snapshot.magic == SNAPSHOT_MAGIC
+    && snapshot.checksum == snapshot_checksum()
+    && snapshot.band < LAST_BAND
+    && snapshot.speed >= KEY_MIN_SPEED && snapshot.speed <= KEY_MAX_SPEED;
+}
+
+/**
+ * Save the operating state to the snapshot. This is cheap enough to be done on
+ * every iteration of loop().
+ */
+void save_snapshot(void)
+{
+  snapshot.magic = SNAPSHOT_MAGIC;
+  snapshot.state = state.state;
+  snapshot.band = state.band;
+  snapshot.op_freq = state.op_freq;
+  snapshot.rit_tx_freq = state.rit_tx_freq;
+  snapshot.vfo_other_freq = state.vfo_other_freq;
+  snapshot.rit = state.rit;
+  snapshot.split = state.split;
+  snapshot.vfo = state.vfo;
+  snapshot.speed = state.key.speed;
+  snapshot.checksum = snapshot_checksum();
+}
+
+/**
+ * Restore the operating state from the snapshot after a watchdog reset. The
+ * state is not restored, since the state we were in may have been responsible
+ * for the reset: we resume in the state chosen by setup(), which is S_DEFAULT
+ * unless the device still has to be calibrated.
+ */
+void resume_snapshot(void)
+{
+  state.band = snapshot.band;
+  state.op_freq = snapshot.op_freq;
+  state.rit_tx_freq = snapshot.rit_tx_freq;
+  state.vfo_other_freq = snapshot.vfo_other_freq;
+  state.rit = snapshot.rit;
+  state.split = snapshot.split;
+  state.vfo = snapshot.vfo;
+  state.key.speed = snapshot.speed;
+  load_cw_speed();
+  fix_op_freq(0);
+  invalidate_frequencies();
 }
 
 // vim: tabstop=2 shiftwidth=2 expandtab:
@@ -22,339 +22,113 @@
 
 void nextband(int8_t);
 
+/* The band plans. Each plan is a list of bands in increasing frequency. A band
+ * is given with BAND(name, default operating frequency), and is followed by
+ * one or more SEGMENT(name, low, high) entries (inclusive, in mHz). Use
+ * multiple segments to describe gaps within a band. The tables and the lookup
+ * routines in bands.ino are generated from these lists. */
 #ifdef PLAN_IARU1
-enum band
-# ifdef __cplusplus
-  : unsigned char
-# endif
-  {
-  BAND_630, BAND_160, BAND_80, BAND_60, BAND_40, BAND_30, BAND_20,
-  BAND_17, BAND_15, BAND_12, BAND_10,
-  LAST_BAND, BAND_UNKNOWN = 0xff
-};
-const unsigned char BAND_DIGITS_1[] = "61864321111";
-const unsigned char BAND_DIGITS_2[] = "36000007520";
-const unsigned char BAND_DIGITS_3[] = "00mmmmmmmmm";
-const unsigned char BAND_DIGITS_4[] = "mm\0\0\0\0\0\0\0\0\0";
-# ifndef DEFAULT_OP_FREQ_630
-# define DEFAULT_OP_FREQ_630 47250000
-# endif
-# ifndef DEFAULT_OP_FREQ_160
-# define DEFAULT_OP_FREQ_160 183600000
-# endif
-# ifndef DEFAULT_OP_FREQ_80
-# define DEFAULT_OP_FREQ_80  356000000
-# endif
-# ifndef DEFAULT_OP_FREQ_60
-# define DEFAULT_OP_FREQ_60  535150000
-# endif
-# ifndef DEFAULT_OP_FREQ_40
-# define DEFAULT_OP_FREQ_40  703000000
-# endif
-# ifndef DEFAULT_OP_FREQ_30
-# define DEFAULT_OP_FREQ_30 1011600000
-# endif
-# ifndef DEFAULT_OP_FREQ_20
-# define DEFAULT_OP_FREQ_20 1406000000
-# endif
-# ifndef DEFAULT_OP_FREQ_17
-# define DEFAULT_OP_FREQ_17 1808600000
-# endif
-# ifndef DEFAULT_OP_FREQ_15
-# define DEFAULT_OP_FREQ_15 2106000000u
-# endif
-# ifndef DEFAULT_OP_FREQ_12
-# define DEFAULT_OP_FREQ_12 2490600000u
-# endif
-# ifndef DEFAULT_OP_FREQ_10
-# define DEFAULT_OP_FREQ_10 2806000000u
-# endif
-const unsigned long BAND_LIMITS_LOW[] =
-  {  47200000
-  ,  181000000
-  ,  350000000
-  ,  535150000
-  ,  700000000
-  , 1010000000
-  , 1400000000
-  , 1806800000
-  , 2100000000u
-  , 2489000000u
-  , 2800000000u
-  };
-const unsigned long BAND_LIMITS_HIGH[] =
-  {  47900000
-  ,  199999999
-  ,  380000000
-  ,  536650000
-  ,  720000000
-  , 1015000000
-  , 1435000000
-  , 1816800000
-  , 2145000000u
-  , 2499000000u
-  , 2970000000u
-  };
-const unsigned long BAND_OP_FREQS[] =
-  { DEFAULT_OP_FREQ_630
-  , DEFAULT_OP_FREQ_160
-  , DEFAULT_OP_FREQ_80
-  , DEFAULT_OP_FREQ_60
-  , DEFAULT_OP_FREQ_40
-  , DEFAULT_OP_FREQ_30
-  , DEFAULT_OP_FREQ_20
-  , DEFAULT_OP_FREQ_17
-  , DEFAULT_OP_FREQ_15
-  , DEFAULT_OP_FREQ_12
-  , DEFAULT_OP_FREQ_10
-  };
+# define BAND_PLAN(BAND, SEGMENT) \
+  BAND(630,  47250000)   SEGMENT(630,  47200000,   47900000)   \
+  BAND(160,  183600000)  SEGMENT(160,  181000000,  199999999)  \
+  BAND(80,   356000000)  SEGMENT(80,   350000000,  380000000)  \
+  BAND(60,   535150000)  SEGMENT(60,   535150000,  536650000)  \
+  BAND(40,   703000000)  SEGMENT(40,   700000000,  720000000)  \
+  BAND(30,  1011600000)  SEGMENT(30,  1010000000,  1015000000) \
+  BAND(20,  1406000000)  SEGMENT(20,  1400000000,  1435000000) \
+  BAND(17,  1808600000)  SEGMENT(17,  1806800000,  1816800000) \
+  BAND(15,  2106000000u) SEGMENT(15,  2100000000u, 2145000000u) \
+  BAND(12,  2490600000u) SEGMENT(12,  2489000000u, 2499000000u) \
+  BAND(10,  2806000000u) SEGMENT(10,  2800000000u, 2970000000u)
 #elif defined(PLAN_IARU2)
-enum band
-# ifdef __cplusplus
-  : unsigned char
-# endif
-  {
-  BAND_630, BAND_160, BAND_80, BAND_60, BAND_40, BAND_30, BAND_20,
-  BAND_17, BAND_15, BAND_12, BAND_10,
-  LAST_BAND, BAND_UNKNOWN = 0xff
-};
-const unsigned char BAND_DIGITS_1[] = "61864321111";
-const unsigned char BAND_DIGITS_2[] = "36000007520";
-const unsigned char BAND_DIGITS_3[] = "00mmmmmmmmm";
-const unsigned char BAND_DIGITS_4[] = "mm\0\0\0\0\0\0\0\0\0";
-# ifndef DEFAULT_OP_FREQ_630
-# define DEFAULT_OP_FREQ_630 47250000
-# endif
-# ifndef DEFAULT_OP_FREQ_160
-# define DEFAULT_OP_FREQ_160 181200000
-# endif
-# ifndef DEFAULT_OP_FREQ_80
-# define DEFAULT_OP_FREQ_80  356000000
-# endif
-# ifndef DEFAULT_OP_FREQ_60
-# define DEFAULT_OP_FREQ_60  535150000
-# endif
-# ifndef DEFAULT_OP_FREQ_40
-# define DEFAULT_OP_FREQ_40  703000000
-# endif
-# ifndef DEFAULT_OP_FREQ_30
-# define DEFAULT_OP_FREQ_30 1011600000
-# endif
-# ifndef DEFAULT_OP_FREQ_20
-# define DEFAULT_OP_FREQ_20 1406000000
-# endif
-# ifndef DEFAULT_OP_FREQ_17
-# define DEFAULT_OP_FREQ_17 1808600000
-# endif
-# ifndef DEFAULT_OP_FREQ_15
-# define DEFAULT_OP_FREQ_15 2106000000u
-# endif
-# ifndef DEFAULT_OP_FREQ_12
-# define DEFAULT_OP_FREQ_12 2490600000u
-# endif
-# ifndef DEFAULT_OP_FREQ_10
-# define DEFAULT_OP_FREQ_10 2806000000u
-# endif
-const unsigned long BAND_LIMITS_LOW[] =
-  {  47200000
-  ,  180000000
-  ,  350000000
-  ,  535150000
-  ,  700000000
-  , 1010000000
-  , 1400000000
-  , 1806800000
-  , 2100000000u
-  , 2489000000u
-  , 2800000000u
-  };
-const unsigned long BAND_LIMITS_HIGH[] =
-  {  47900000
-  ,  199999999
-  ,  399999999
-  ,  536650000
-  ,  730000000
-  , 1015000000
-  , 1435000000
-  , 1816800000
-  , 2145000000u
-  , 2499000000u
-  , 2970000000u
-  };
-const unsigned long BAND_OP_FREQS[] =
-  { DEFAULT_OP_FREQ_630
-  , DEFAULT_OP_FREQ_160
-  , DEFAULT_OP_FREQ_80
-  , DEFAULT_OP_FREQ_60
-  , DEFAULT_OP_FREQ_40
-  , DEFAULT_OP_FREQ_30
-  , DEFAULT_OP_FREQ_20
-  , DEFAULT_OP_FREQ_17
-  , DEFAULT_OP_FREQ_15
-  , DEFAULT_OP_FREQ_12
-  , DEFAULT_OP_FREQ_10
-  };
+# define BAND_PLAN(BAND, SEGMENT) \
+  BAND(630,  47250000)   SEGMENT(630,  47200000,   47900000)   \
+  BAND(160,  181200000)  SEGMENT(160,  180000000,  199999999)  \
+  BAND(80,   356000000)  SEGMENT(80,   350000000,  399999999)  \
+  BAND(60,   535150000)  SEGMENT(60,   535150000,  536650000)  \
+  BAND(40,   703000000)  SEGMENT(40,   700000000,  730000000)  \
+  BAND(30,  1011600000)  SEGMENT(30,  1010000000,  1015000000) \
+  BAND(20,  1406000000)  SEGMENT(20,  1400000000,  1435000000) \
+  BAND(17,  1808600000)  SEGMENT(17,  1806800000,  1816800000) \
+  BAND(15,  2106000000u) SEGMENT(15,  2100000000u, 2145000000u) \
+  BAND(12,  2490600000u) SEGMENT(12,  2489000000u, 2499000000u) \
+  BAND(10,  2806000000u) SEGMENT(10,  2800000000u, 2970000000u)
 #elif defined(PLAN_IARU3)
+# define BAND_PLAN(BAND, SEGMENT) \
+  BAND(630,  47250000)   SEGMENT(630,  47200000,   47900000)   \
+  BAND(160,  181200000)  SEGMENT(160,  180000000,  199999999)  \
+  BAND(80,   356000000)  SEGMENT(80,   350000000,  390000000)  \
+  BAND(40,   703000000)  SEGMENT(40,   700000000,  730000000)  \
+  BAND(30,  1011600000)  SEGMENT(30,  1010000000,  1015000000) \
+  BAND(20,  1406000000)  SEGMENT(20,  1400000000,  1435000000) \
+  BAND(17,  1808600000)  SEGMENT(17,  1806800000,  1816800000) \
+  BAND(15,  2106000000u) SEGMENT(15,  2100000000u, 2145000000u) \
+  BAND(12,  2490600000u) SEGMENT(12,  2489000000u, 2499000000u) \
+  BAND(10,  2806000000u) SEGMENT(10,  2800000000u, 2970000000u)
+#elif defined(PLAN_VK)
+# define BAND_PLAN(BAND, SEGMENT) \
+  BAND(630,  47250000)   SEGMENT(630,  47200000,   47900000)   \
+  BAND(160,  183200000)  SEGMENT(160,  180000000,  187500000)  \
+  BAND(80,   353200000)  SEGMENT(80,   350000000,  370000000)  \
+                         SEGMENT(80,   377600000,  380000000)  \
+  BAND(40,   703200000)  SEGMENT(40,   700000000,  730000000)  \
+  BAND(30,  1011600000)  SEGMENT(30,  1010000000,  1015000000) \
+  BAND(20,  1406200000)  SEGMENT(20,  1400000000,  1435000000) \
+  BAND(17,  1808600000)  SEGMENT(17,  1806800000,  1816800000) \
+  BAND(15,  2106200000u) SEGMENT(15,  2100000000u, 2145000000u) \
+  BAND(12,  2490800000u) SEGMENT(12,  2489000000u, 2499000000u) \
+  BAND(10,  2806200000u) SEGMENT(10,  2800000000u, 2970000000u)
+#else
+# error Please select a band plan using #define PLAN_...
+#endif
+
+/* Overrides of the default operating frequencies (see settings.h); 0 means
+ * the default from the band plan is used. */
+#ifndef DEFAULT_OP_FREQ_630
+# define DEFAULT_OP_FREQ_630 0
+#endif
+#ifndef DEFAULT_OP_FREQ_160
+# define DEFAULT_OP_FREQ_160 0
+#endif
+#ifndef DEFAULT_OP_FREQ_80
+# define DEFAULT_OP_FREQ_80  0
+#endif
+#ifndef DEFAULT_OP_FREQ_60
+# define DEFAULT_OP_FREQ_60  0
+#endif
+#ifndef DEFAULT_OP_FREQ_40
+# define DEFAULT_OP_FREQ_40  0
+#endif
+#ifndef DEFAULT_OP_FREQ_30
+# define DEFAULT_OP_FREQ_30  0
+#endif
+#ifndef DEFAULT_OP_FREQ_20
+# define DEFAULT_OP_FREQ_20  0
+#endif
+#ifndef DEFAULT_OP_FREQ_17
+# define DEFAULT_OP_FREQ_17  0
+#endif
+#ifndef DEFAULT_OP_FREQ_15
+# define DEFAULT_OP_FREQ_15  0
+#endif
+#ifndef DEFAULT_OP_FREQ_12
+# define DEFAULT_OP_FREQ_12  0
+#endif
+#ifndef DEFAULT_OP_FREQ_10
+# define DEFAULT_OP_FREQ_10  0
+#endif
+
+#define BAND_PLAN_IGNORE(...)
+#define BAND_ENUM_ENTRY(name, op_freq) BAND_##name,
+
 enum band
-# ifdef __cplusplus
+#ifdef __cplusplus
   : unsigned char
-# endif
+#endif
   {
-  BAND_630, BAND_160, BAND_80, BAND_40, BAND_30, BAND_20,
-  BAND_17, BAND_15, BAND_12, BAND_10,
-  LAST_BAND, BAND_UNKNOWN = 0xff
-};
-const unsigned char BAND_DIGITS_1[] = "61864321111";
-const unsigned char BAND_DIGITS_2[] = "36000007520";
-const unsigned char BAND_DIGITS_3[] = "00mmmmmmmmm";
-const unsigned char BAND_DIGITS_4[] = "mm\0\0\0\0\0\0\0\0\0";
-# ifndef DEFAULT_OP_FREQ_630
-# define DEFAULT_OP_FREQ_630 47250000
-# endif
-# ifndef DEFAULT_OP_FREQ_160
-# define DEFAULT_OP_FREQ_160 181200000
-# endif
-# ifndef DEFAULT_OP_FREQ_80
-# define DEFAULT_OP_FREQ_80  356000000
-# endif
-# ifndef DEFAULT_OP_FREQ_40
-# define DEFAULT_OP_FREQ_40  703000000
-# endif
-# ifndef DEFAULT_OP_FREQ_30
-# define DEFAULT_OP_FREQ_30 1011600000
-# endif
-# ifndef DEFAULT_OP_FREQ_20
-# define DEFAULT_OP_FREQ_20 1406000000
-# endif
-# ifndef DEFAULT_OP_FREQ_17
-# define DEFAULT_OP_FREQ_17 1808600000
-# endif
-# ifndef DEFAULT_OP_FREQ_15
-# define DEFAULT_OP_FREQ_15 2106000000u
-# endif
-# ifndef DEFAULT_OP_FREQ_12
-# define DEFAULT_OP_FREQ_12 2490600000u
-# endif
-# ifndef DEFAULT_OP_FREQ_10
-# define DEFAULT_OP_FREQ_10 2806000000u
-# endif
-const unsigned long BAND_LIMITS_LOW[] =
-  {  47200000
-  ,  180000000
-  ,  350000000
-  ,  700000000
-  , 1010000000
-  , 1400000000
-  , 1806800000
-  , 2100000000u
-  , 2489000000u
-  , 2800000000u
-  };
-const unsigned long BAND_LIMITS_HIGH[] =
-  {  47900000
-  ,  199999999
-  ,  390000000
-  ,  730000000
-  , 1015000000
-  , 1435000000
-  , 1816800000
-  , 2145000000u
-  , 2499000000u
-  , 2970000000u
-  };
-const unsigned long BAND_OP_FREQS[] =
-  { DEFAULT_OP_FREQ_630
-  , DEFAULT_OP_FREQ_160
-  , DEFAULT_OP_FREQ_80
-  , DEFAULT_OP_FREQ_40
-  , DEFAULT_OP_FREQ_30
-  , DEFAULT_OP_FREQ_20
-  , DEFAULT_OP_FREQ_17
-  , DEFAULT_OP_FREQ_15
-  , DEFAULT_OP_FREQ_12
-  , DEFAULT_OP_FREQ_10
-  };
-#elif defined(PLAN_VK)
-enum band : unsigned char {
-  BAND_630, BAND_160, BAND_80, BAND_40, BAND_30, BAND_20,
-  BAND_17, BAND_15, BAND_12, BAND_10,
+  BAND_PLAN(BAND_ENUM_ENTRY, BAND_PLAN_IGNORE)
   LAST_BAND, BAND_UNKNOWN = 0xff
 };
-const unsigned char BAND_DIGITS_2[] = {6,1,8,4,3,2,1,1,1,1};
-const unsigned char BAND_DIGITS_1[] = {3,6,0,0,0,0,7,5,2,0};
-# ifndef DEFAULT_OP_FREQ_630
-# define DEFAULT_OP_FREQ_630 47250000
-# endif
-# ifndef DEFAULT_OP_FREQ_160
-# define DEFAULT_OP_FREQ_160 183200000
-# endif
-# ifndef DEFAULT_OP_FREQ_80
-# define DEFAULT_OP_FREQ_80  353200000
-# endif
-# ifndef DEFAULT_OP_FREQ_40
-# define DEFAULT_OP_FREQ_40  703200000
-# endif
-# ifndef DEFAULT_OP_FREQ_30
-# define DEFAULT_OP_FREQ_30 1011600000
-# endif
-# ifndef DEFAULT_OP_FREQ_20
-# define DEFAULT_OP_FREQ_20 1406200000
-# endif
-# ifndef DEFAULT_OP_FREQ_17
-# define DEFAULT_OP_FREQ_17 1808600000
-# endif
-# ifndef DEFAULT_OP_FREQ_15
-# define DEFAULT_OP_FREQ_15 2106200000u
-# endif
-# ifndef DEFAULT_OP_FREQ_12
-# define DEFAULT_OP_FREQ_12 2490800000u
-# endif
-# ifndef DEFAULT_OP_FREQ_10
-# define DEFAULT_OP_FREQ_10 2806200000u
-# endif
-const unsigned long BAND_LIMITS_LOW[] =
-  {  47200000
-  ,  180000000
-  ,  350000000
-  ,  700000000
-  , 1010000000
-  , 1400000000
-  , 1806800000
-  , 2100000000u
-  , 2489000000u
-  , 2800000000u
-  };
-const unsigned long BAND_LIMITS_HIGH[] =
-  {  47900000
-  ,  187500000
-  ,  380000000
-  ,  730000000
-  , 1015000000
-  , 1435000000
-  , 1816800000
-  , 2145000000u
-  , 2499000000u
-  , 2970000000u
-  };
-// Special definitions to support gapped 80m band in VK
-#define BAND_80_LOW_TOP 370000000
-#define BAND_80_HIGH_BOTTOM 377600000
-#define BAND_80_GAP_MIDDLE (BAND_80_LOW_TOP+BAND_80_HIGH_BOTTOM)/2
-const unsigned long BAND_OP_FREQS[] =
-  { DEFAULT_OP_FREQ_630
-  , DEFAULT_OP_FREQ_160
-  , DEFAULT_OP_FREQ_80
-  , DEFAULT_OP_FREQ_40
-  , DEFAULT_OP_FREQ_30
-  , DEFAULT_OP_FREQ_20
-  , DEFAULT_OP_FREQ_17
-  , DEFAULT_OP_FREQ_15
-  , DEFAULT_OP_FREQ_12
-  , DEFAULT_OP_FREQ_10
-  };
-#else
-# error Please select a band plan using #define PLAN_...
-#endif
 
 #endif
 // vim: tabstop=2 shiftwidth=2 expandtab:
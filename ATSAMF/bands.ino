@@ -17,6 +17,142 @@
 
 #include "bands.h"
 
+struct band_segment {
+  unsigned long low;
+  unsigned long high;
+  enum band band;
+};
+
+#define BAND_SEGMENT_ENTRY(name, low, high) {low, high, BAND_##name},
+#define BAND_FIRST_SEGMENT_ENTRY(name, op_freq) first_segment(BAND_##name, 0),
+#define BAND_OP_FREQ_ENTRY(name, op_freq) \
+  (DEFAULT_OP_FREQ_##name ? DEFAULT_OP_FREQ_##name : op_freq),
+#define BAND_NAME_ENTRY(name, op_freq) #name "m",
+
+/**
+ * All segments of the band plan, sorted by frequency.
+ */
+static constexpr struct band_segment BAND_SEGMENTS[] PROGMEM =
+  { BAND_PLAN(BAND_PLAN_IGNORE, BAND_SEGMENT_ENTRY) };
+
+#define SEGMENT_COUNT (sizeof(BAND_SEGMENTS) / sizeof(BAND_SEGMENTS[0]))
+
+/**
+ * Find the index of the first segment of a band (at compile time).
+ */
+static constexpr byte first_segment(enum band band, byte i)
+{
+  return i == SEGMENT_COUNT || BAND_SEGMENTS[i].band >= band
+    ? i : first_segment(band, i + 1);
+}
+
+/**
+ * Check that the segments are non-empty, sorted and disjoint.
+ */
+static constexpr bool segments_sorted(byte i)
+{
+  return i == SEGMENT_COUNT
+    || (BAND_SEGMENTS[i].low <= BAND_SEGMENTS[i].high
+      && (i + 1 == SEGMENT_COUNT
+        || (BAND_SEGMENTS[i].high < BAND_SEGMENTS[i + 1].low
+          && BAND_SEGMENTS[i].band <= BAND_SEGMENTS[i + 1].band))
+      && segments_sorted(i + 1));
+}
+
+static_assert(segments_sorted(0), "band plan segments must be sorted and disjoint");
+
+/**
+ * For every band, the index of its first segment in BAND_SEGMENTS. The extra
+ * element at the end makes that the segments of band b are always
+ * BAND_FIRST_SEGMENT[b] .. BAND_FIRST_SEGMENT[b+1]-1.
+ */
+static constexpr byte BAND_FIRST_SEGMENT[] PROGMEM =
+  { BAND_PLAN(BAND_FIRST_SEGMENT_ENTRY, BAND_PLAN_IGNORE) SEGMENT_COUNT };
+
+static const unsigned long BAND_OP_FREQS[] PROGMEM =
+  { BAND_PLAN(BAND_OP_FREQ_ENTRY, BAND_PLAN_IGNORE) };
+
+static const char BAND_NAMES[][5] PROGMEM =
+  { BAND_PLAN(BAND_NAME_ENTRY, BAND_PLAN_IGNORE) };
+
+static unsigned long segment_low(byte i)
+{
+  return pgm_read_dword(&BAND_SEGMENTS[i].low);
+}
+
+static unsigned long segment_high(byte i)
+{
+  return pgm_read_dword(&BAND_SEGMENTS[i].high);
+}
+
+/**
+ * The lowest frequency of a band.
+ */
+unsigned long band_limit_low(enum band band)
+{
+  return segment_low(pgm_read_byte(&BAND_FIRST_SEGMENT[band]));
+}
+
+/**
+ * The highest frequency of a band.
+ */
+unsigned long band_limit_high(enum band band)
+{
+  return segment_high(pgm_read_byte(&BAND_FIRST_SEGMENT[band + 1]) - 1);
+}
+
+/**
+ * The name of a band (e.g. "80m"), copied to a buffer of at least 5 bytes.
+ */
+void band_name(enum band band, char *name)
+{
+  memcpy_P(name, BAND_NAMES[band], sizeof(BAND_NAMES[band]));
+}
+
+/**
+ * Fix a frequency within the segments of a band.
+ * Frequencies below or above the band are moved to the band edge. Frequencies
+ * in a gap between two segments are moved across the gap when tuning up or
+ * down (according to the step), and to the nearest edge otherwise.
+ *
+ * @param band the band.
+ * @param freq the frequency to fix.
+ * @param step the last tuning step (0 if not tuning).
+ * @return the fixed frequency.
+ */
+unsigned long band_fix_freq(enum band band, unsigned long freq, long step)
+{
+  byte first = pgm_read_byte(&BAND_FIRST_SEGMENT[band]);
+  byte last = pgm_read_byte(&BAND_FIRST_SEGMENT[band + 1]) - 1;
+  byte lo = first, hi = last + 1;
+
+  /* find the first segment that does not end below freq */
+  while (lo < hi) {
+    byte mid = (lo + hi) / 2;
+    if (segment_high(mid) < freq)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo > last)
+    return segment_high(last);
+
+  unsigned long low = segment_low(lo);
+  if (freq >= low)
+    return freq;
+  else if (lo == first)
+    return low;
+
+  unsigned long below = segment_high(lo - 1);
+  if (step > 0)
+    return low;
+  else if (step < 0)
+    return below;
+  else
+    return freq - below < low - freq ? below : low;
+}
+
 /**
  * Switch to another band. The display and frequencies are updated.
  *
@@ -35,11 +171,12 @@ void nextband(int8_t up_or_down)
 }
 
 /**
- * Update frequencies after a band change.
+ * Update frequencies after a band change. Both VFOs are reset.
  */
 void setup_band(void)
 {
-  state.op_freq = BAND_OP_FREQS[state.band];
+  state.op_freq = pgm_read_dword(&BAND_OP_FREQS[state.band]);
+  vfo_reset();
   invalidate_frequencies();
 }
 
@@ -40,11 +40,23 @@ struct inputs {
     unsigned char encoder_value:2;
   };
   unsigned char encoder_last_clock:1;
+  unsigned char changed:1; /* see buttons_isr() */
 };
 
+/* The buttons, as bits of inputs.port */
+#define BUTTON_ENCODER (1 << 2)
+#define BUTTON_RIT     (1 << 3)
+#define BUTTON_KEYER   (1 << 4)
+#define BUTTONS        (BUTTON_ENCODER | BUTTON_RIT | BUTTON_KEYER)
+
 void buttons_isr(void);
+void buttons_poll(void);
+byte button_pressed(byte);
+unsigned int button_released(byte);
+unsigned int button_held(byte);
 unsigned int time_rit(void);
 unsigned int time_keyer(void);
+unsigned int time_encoder_button(void);
 
 #endif
 
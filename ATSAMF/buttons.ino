@@ -17,14 +17,35 @@
 
 #include "buttons.h"
 
+/* The status of the last button press, see buttons_poll() */
+#define PRESS_NONE     0
+#define PRESS_HELD     1 /* the press has not been handled yet */
+#define PRESS_HANDLED  2 /* the press has been handled; the release is ignored */
+#define PRESS_RELEASED 3 /* see button_released() */
+#define PRESS_DEBOUNCE 4 /* the buttons are ignored for DEBOUNCE_TIME */
+
+#define DEBOUNCE_TIME     50
+#define FEEDBACK_INTERVAL 32 /* ms between updates of the feedback while held */
+
+static byte last_inputs = 0;
+
+static byte button;
+static byte button_status = PRESS_NONE;
+static unsigned long button_time; /* time of the press, or of the release */
+static unsigned int button_duration;
+
 /**
  * The ISR for buttons. Should be called regularly (ideally from a timer ISR).
  * Set PORTD to inputs and stores the state of buttons to state.inputs.
  * Checks if the rotary encoder was turned and updates state.inputs.encoders.
+ * When a button, the encoder or the key has changed, state.inputs.changed is
+ * set, so that the input task is posted (see tasks_isr()).
  * Restores PORTD to outputs.
  */
 void buttons_isr(void)
 {
+  byte inputs;
+
   state.inputs.port = ~PIND;
   if (state.inputs.encoder_clock != state.inputs.encoder_last_clock) {
     if (!state.inputs.encoder_last_clock) {
@@ -35,152 +56,247 @@ void buttons_isr(void)
     }
     state.inputs.encoder_last_clock = state.inputs.encoder_clock;
   }
+
+  inputs = (state.inputs.port & 0x1f) | (~PINC & 0x0c) << 3;
+  if (inputs != last_inputs) {
+    last_inputs = inputs;
+    state.inputs.changed = 1;
+  }
+  trace_inputs(inputs);
 }
 
 /**
- * Time how long the RIT button was pressed.
- * Gives feedback about the selected option.
+ * Update the status of the buttons. This should be called by the input task
+ * before the state handlers, which then use button_pressed(),
+ * button_released() and button_held(). Only one button is tracked at a time.
+ * After a release, the buttons are ignored for DEBOUNCE_TIME; the input task is
+ * posted again at the end of that time. While a button is held and its press
+ * has not been handled, the input task is posted every FEEDBACK_INTERVAL, so
+ * that feedback can be given about the selected option (see time_rit()).
  */
-unsigned int time_rit(void)
+void buttons_poll(void)
 {
-  unsigned int duration = 0;
-  unsigned long start_time = tcount;
-
-  do {
-    duration = tcount - start_time;
-    if (duration >
-#ifdef OPT_ERASE_EEPROM
-        14000
-#else
-        11000
-#endif
-        ) {
-      display_feedback("Cancel...");
-    } else
-#ifdef OPT_ERASE_EEPROM
-    if (duration > 11000) {
-      display_feedback("Erase EEPROM...");
-      display_progress(11000, 14000, duration);
-    } else
-#endif
-    if (duration > 8000) {
-      display_feedback("Recalibrate...");
-      display_progress(8000, 11000, duration);
-    } else if (duration > 5000) {
-      display_feedback("Change band...");
-      display_progress(5000, 8000, duration);
-    } else if (duration > 2000) {
-      display_feedback("Set CW speed...");
-      display_progress(2000, 5000, duration);
-    }
-    else if (duration > 500) {
-      display_feedback("RIT...");
-      display_progress(500, 2000, duration);
-    }
-    delay(1);
-  } while (state.inputs.rit);
-  debounce_rit();
+  byte port = state.inputs.port & BUTTONS;
+  unsigned long elapsed = tcount - button_time;
 
-  if (duration > 500)
-    display_feedback("");
-  display_clear_progress();
+  switch (button_status) {
+    case PRESS_RELEASED:
+      button_status = PRESS_DEBOUNCE;
+      /* fall through */
+    case PRESS_DEBOUNCE:
+      if (elapsed < DEBOUNCE_TIME) {
+        task_post_in(TASK_INPUT, DEBOUNCE_TIME - elapsed);
+        return;
+      }
+      button_status = PRESS_NONE;
+      /* fall through */
+    case PRESS_NONE:
+      if (!port)
+        return;
+      button = port & -port;
+      button_status = PRESS_HELD;
+      button_time = tcount;
+      break;
+    case PRESS_HELD:
+    case PRESS_HANDLED:
+      if (port & button)
+        break;
+      button_duration = elapsed;
+      button_status = button_status == PRESS_HELD ? PRESS_RELEASED : PRESS_DEBOUNCE;
+      button_time = tcount;
+      task_post_in(TASK_INPUT, DEBOUNCE_TIME);
+      return;
+  }
 
-  return duration;
+  if (button_status == PRESS_HELD)
+    task_post_in(TASK_INPUT, FEEDBACK_INTERVAL);
 }
 
 /**
- * Time how long the keyer button was pressed.
- * Gives feedback about the selected option.
+ * Check if a button was pressed. The press is handled by this, so that the
+ * release of the button is ignored.
+ *
+ * @param which one of BUTTON_ENCODER, BUTTON_RIT and BUTTON_KEYER.
+ * @return 1 if it was, 0 if not.
  */
-unsigned int time_keyer(void)
+byte button_pressed(byte which)
 {
-  unsigned int duration = 0;
-  unsigned long start_time = tcount;
-
-  do {
-    duration = tcount - start_time;
-    if (duration > 8000) {
-      display_feedback("Cancel...");
-    } else if (duration > 5000) {
-      display_feedback("Enter memory...");
-      display_progress(5000, 8000, duration);
-    } else if (duration > 2000) {
-      display_feedback("Tune mode...");
-      display_progress(2000, 5000, duration);
-    } else if (duration > 500) {
-      if (state.beacon)
-        display_feedback("Beacon");
-      else
-        display_feedback("Send memory");
-      display_progress(500, 2000, duration);
-    }
-    delay(1);
-  } while (state.inputs.keyer); // wait until the bit goes high.
-  debounce_keyer();
+  if (button_status != PRESS_HELD || button != which)
+    return 0;
+  button_status = PRESS_HANDLED;
+  return 1;
+}
 
-  if (duration > 500)
-    display_feedback("");
-  display_clear_progress();
+/**
+ * Check if a button was released, when the press was not handled with
+ * button_pressed(). After checking, the status will be cleared.
+ *
+ * @param which one of BUTTON_ENCODER, BUTTON_RIT and BUTTON_KEYER.
+ * @return the time the button was held in ms, or 0 if it was not released.
+ */
+unsigned int button_released(byte which)
+{
+  if (button_status != PRESS_RELEASED || button != which)
+    return 0;
+  button_status = PRESS_DEBOUNCE;
+  return button_duration;
+}
 
-  return duration;
+/**
+ * Check if a button is held, when the press was not handled with
+ * button_pressed().
+ *
+ * @param which one of BUTTON_ENCODER, BUTTON_RIT and BUTTON_KEYER.
+ * @return the time the button has been held in ms, or 0 if it is not held.
+ */
+unsigned int button_held(byte which)
+{
+  if (button_status != PRESS_HELD || button != which)
+    return 0;
+  return tcount - button_time;
 }
 
 /**
- * Time how long the encoder button was pressed.
- * Gives feedback about the selected option.
+ * Clear the feedback of time_rit(), time_keyer() and time_encoder_button()
+ * when a button is released.
+ *
+ * @return the time the button was held in ms, or 0 if it was not released.
  */
-unsigned int time_encoder_button(void)
+static unsigned int time_release(byte which)
 {
-  unsigned int duration = 0;
-  unsigned long start_time = tcount;
-
-  do {
-    duration = tcount - start_time;
-    if (duration > 1000)
-      display_feedback("DFE...");
-    else if (duration > 500) {
-      display_feedback("Tuning step...");
-      display_progress(500, 1000, duration);
-    }
-    delay(1);
-  } while (state.inputs.encoder_button);
-  debounce_encoder_button();
+  unsigned int duration = button_released(which);
 
   if (duration > 500)
     display_feedback("");
-  display_clear_progress();
+  if (duration)
+    display_clear_progress();
 
   return duration;
 }
 
 /**
- * Debounce the keyer button.
+ * Time how long the RIT button was pressed.
+ * Gives feedback about the selected option while it is held.
+ *
+ * @return the time the button was held when it was released, or 0.
  */
-void debounce_keyer(void)
+unsigned int time_rit(void)
 {
-  do
-    delay(50);
-  while (state.inputs.keyer);
+  unsigned int duration = button_held(BUTTON_RIT);
+
+  if (!duration)
+    return time_release(BUTTON_RIT);
+
+  if (duration >
+#ifdef OPT_ERASE_EEPROM
+      14000
+#else
+      11000
+#endif
+      ) {
+    display_feedback("Cancel...");
+  } else
+#ifdef OPT_ERASE_EEPROM
+  if (duration > 11000) {
+    display_feedback("Erase EEPROM...");
+    display_progress(11000, 14000, duration);
+  } else
+#endif
+  if (duration > 8000) {
+    display_feedback("Recalibrate...");
+    display_progress(8000, 11000, duration);
+  } else if (duration > 5000) {
+    display_feedback("Change band...");
+    display_progress(5000, 8000, duration);
+  } else if (duration > 2000) {
+    display_feedback("Set CW speed...");
+    display_progress(2000, 5000, duration);
+  } else if (duration > 1000) {
+    display_feedback("VFO A/B...");
+    display_progress(1000, 2000, duration);
+  } else if (duration > 500) {
+    display_feedback("RIT...");
+    display_progress(500, 1000, duration);
+  }
+
+  return 0;
 }
 
 /**
- * Debounce the RIT button.
+ * Time how long the keyer button was pressed.
+ * Gives feedback about the selected option while it is held.
+ *
+ * @return the time the button was held when it was released, or 0.
  */
-void debounce_rit(void)
+unsigned int time_keyer(void)
 {
-  do
-    delay(50);
-  while (state.inputs.rit);
+  unsigned int duration = button_held(BUTTON_KEYER);
+
+  if (!duration)
+    return time_release(BUTTON_KEYER);
+
+  if (duration > 8000) {
+    display_feedback("Cancel...");
+  } else if (duration > 5000) {
+    display_feedback("Enter memory...");
+    display_progress(5000, 8000, duration);
+  } else if (duration > 2000) {
+    display_feedback("Tune mode...");
+    display_progress(2000, 5000, duration);
+  } else if (duration > 500) {
+    if (state.beacon)
+      display_feedback("Beacon");
+    else
+      display_feedback("Send memory");
+    display_progress(500, 2000, duration);
+  }
+
+  return 0;
 }
 
 /**
- * Debounce the rotary encoder button.
+ * Time how long the encoder button was pressed.
+ * Gives feedback about the selected option while it is held.
+ *
+ * @return the time the button was held when it was released, or 0.
  */
-void debounce_encoder_button(void)
+unsigned int time_encoder_button(void)
 {
-  do
-    delay(50);
-  while (state.inputs.encoder_button);
+  unsigned int duration = button_held(BUTTON_ENCODER);
+
+  if (!duration)
+    return time_release(BUTTON_ENCODER);
+
+  if (duration >
+#ifdef OPT_INPUT_TRACE
+      11000
+#else
+      8000
+#endif
+      ) {
+    display_feedback("Cancel...");
+  } else
+#ifdef OPT_INPUT_TRACE
+  if (duration > 8000) {
+    display_feedback("Dump trace...");
+    display_progress(8000, 11000, duration);
+  } else
+#endif
+  if (duration > 5000) {
+    display_feedback("Channels...");
+    display_progress(5000, 8000, duration);
+  } else if (duration > 3000) {
+    display_feedback(state.split ? "Split off..." : "Split on...");
+    display_progress(3000, 5000, duration);
+  } else if (duration > 1000) {
+    display_feedback("DFE...");
+    display_progress(1000, 3000, duration);
+  } else if (duration > 500) {
+    display_feedback("Tuning step...");
+    display_progress(500, 1000, duration);
+  }
+
+  return 0;
 }
 
 /**
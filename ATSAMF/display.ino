@@ -20,6 +20,12 @@
 
 #define BLINKED_ON ((((byte) tcount) >> 7) & 0x01)
 
+#define ECHO_START   6 /* Position of the keyed characters on the second line */
+#define ECHO_LENGTH  9 /* Number of keyed characters shown */
+
+#define FLASH_CIRCLE_TIME 100 /* Time in ms, see display_flash_circle() */
+#define RESET_REPORT_TIME 3000 /* Time in ms, see display_reset_report() */
+
 #define LCD_RS  5
 #define LCD_RW  6
 #define LCD_EN  7
@@ -28,6 +34,10 @@
 #define LCD_D6 10
 #define LCD_D7 11
 
+static void refresh_line_2(void);
+static void display_echo_text(void);
+static void display_freq_value(unsigned long);
+
 static Adafruit_CharacterOLED lcd(OLED_V2, LCD_RS, LCD_RW, LCD_EN, LCD_D4, LCD_D5, LCD_D6, LCD_D7);
 
 #ifdef OPT_USER_DEFINED_CHARACTERS
@@ -41,6 +51,8 @@ static uint8_t character_arr_l[] = {0x0,0x2,0x6,0xe,0x1e,0xe,0x6,0x2};
 static uint8_t character_arr_r[] = {0x0,0x8,0xc,0xe,0xf,0xe,0xc,0x8};
 #endif
 
+static const char *question; /* in S_CONFIRM, see display_question() */
+
 /**
  * Initialize the display: intialize library; show credits; create custom
  * characters.
@@ -70,17 +82,52 @@ void display_init(void)
 static uint8_t current_blinked_on = 0;
 static unsigned short current_blinking_1 = 0;
 
+/**
+ * Ring buffer with the most recently keyed characters, shown on the second
+ * line in S_DEFAULT (see display_echo()).
+ */
+static char echo[ECHO_LENGTH];
+static uint8_t echo_head = 0;
+static uint8_t echo_dirty = 0;
+
+/**
+ * Whether the circle of display_flash_circle() is shown, and since when.
+ */
+static uint8_t flash_circle = 0;
+static unsigned long flash_circle_time;
+
+/**
+ * Whether the report of display_reset_report() is shown, and since when.
+ */
+static uint8_t reset_report = 0;
+static unsigned long reset_report_time;
+
 /**
  * The ISR for the display. Should be called regularly, but *not* from an ISR
  * due to incompatibilities in the Adafruit library.
  */
 void display_isr(void)
 {
+  if (flash_circle && tcount - flash_circle_time >= FLASH_CIRCLE_TIME) {
+    lcd.setCursor(15,1);
+    lcd.print(' ');
+    flash_circle = 0;
+  }
+
+  if (reset_report && tcount - reset_report_time >= RESET_REPORT_TIME)
+    invalidate_display();
+
   if (BLINKED_ON == current_blinked_on)
     return;
 
   current_blinked_on = BLINKED_ON;
 
+  if (echo_dirty && state.state == S_DEFAULT && !reset_report) {
+    display_echo_text();
+    refresh_line_2();
+    echo_dirty = 0;
+  }
+
   int i = 0;
   lcd.setCursor(0,0);
 
@@ -97,8 +144,8 @@ void display_isr(void)
   current_blinking_1 = state.display.blinking_1;
 }
 
-static char current_line_1[16];
-static char current_line_2[16];
+static char current_line_1[17];
+static char current_line_2[17];
 
 /**
  * Send changes in the first line to the display.
@@ -164,9 +211,11 @@ void refresh_display(void)
 void invalidate_display(void)
 {
   state.display.blinking_1 = 0;
+  reset_report = 0;
 
   display_freq();
   display_rit();
+  display_vfo();
   state.display.line_2[0] = '\0';
 
   switch (state.state) {
@@ -187,6 +236,7 @@ void invalidate_display(void)
         state.display.line_2[i++] = 'm';
 #endif
         state.display.line_2[i++] = '\0';
+        display_echo_text();
       }
       break;
     case S_ADJUST_CS:
@@ -225,6 +275,9 @@ void invalidate_display(void)
     case S_DFE:
       display_dfe();
       break;
+    case S_CHANNEL:
+      display_channel();
+      break;
     case S_MEM_ENTER_WAIT:
     case S_MEM_ENTER:
       strcpy(state.display.line_2, "Enter memory");
@@ -238,6 +291,9 @@ void invalidate_display(void)
       state.display.line_2[12] = '0' + (memory_index + 1) / 10;
       state.display.line_2[13] = '0' + (memory_index + 1) % 10;
       break;
+    case S_CALL_ENTER:
+      display_call();
+      break;
     case S_MEM_SEND_WAIT:
       if (state.beacon)
 #ifdef OPT_USER_DEFINED_CHARACTERS
@@ -253,6 +309,7 @@ void invalidate_display(void)
 #endif
       state.display.line_2[8] = '0' + (memory_index + 1) / 10;
       state.display.line_2[9] = '0' + (memory_index + 1) % 10;
+      display_queue(12);
       break;
     case S_MEM_SEND_TX:
       if (state.beacon)
@@ -261,6 +318,7 @@ void invalidate_display(void)
         strcpy(state.display.line_2, "Memory ..");
       state.display.line_2[7] = '0' + (memory_index + 1) / 10;
       state.display.line_2[8] = '0' + (memory_index + 1) % 10;
+      display_queue(10);
       break;
     case S_CALIBRATION_CORRECTION:
       strcpy(state.display.line_1, "Fix 10MHz at TP3");
@@ -274,6 +332,10 @@ void invalidate_display(void)
       strcpy(state.display.line_1, "Peak RX with CP2");
       strcpy(state.display.line_2, "and CP3");
       break;
+    case S_CONFIRM:
+      strcpy(state.display.line_1, question);
+      strcpy(state.display.line_2, "RIT=No Keyer=Yes");
+      break;
     case S_ERROR:
       sprintf(state.display.line_2, "Error %d", errno);
       break;
@@ -282,9 +344,45 @@ void invalidate_display(void)
   refresh_display();
 }
 
+/**
+ * Add a character to the echo of keyed characters. This only updates the ring
+ * buffer, so that it can be called while keying; the display is updated from
+ * display_isr(). Leading and repeated spaces are ignored.
+ */
+void display_echo(char c)
+{
+  char last = echo[(echo_head + ECHO_LENGTH - 1) % ECHO_LENGTH];
+  if (c == ' ' && (last == ' ' || last == '\0'))
+    return;
+
+  echo[echo_head] = c;
+  echo_head = (echo_head + 1) % ECHO_LENGTH;
+  echo_dirty = 1;
+}
+
+/**
+ * Write the echo of keyed characters to the second line at ECHO_START. A
+ * shorter line is padded with spaces up to that position; a longer line is
+ * overwritten, so that the line never exceeds the display.
+ */
+static void display_echo_text(void)
+{
+  uint8_t i = strlen(state.display.line_2);
+
+  while (i < ECHO_START)
+    state.display.line_2[i++] = ' ';
+  i = ECHO_START;
+  for (uint8_t j = 0; j < ECHO_LENGTH; j++) {
+    char c = echo[(echo_head + j) % ECHO_LENGTH];
+    state.display.line_2[i++] = c ? c : ' ';
+  }
+  state.display.line_2[i] = '\0';
+}
+
 /**
  * Briefly show a circle in the right bottom. When the argument is non-zero,
- * the circle is closed.
+ * the circle is closed. The circle is removed by display_isr(), for which the
+ * display task is posted.
  */
 void display_flash_circle(uint8_t type)
 {
@@ -294,20 +392,19 @@ void display_flash_circle(uint8_t type)
 #else
   lcd.print(type ? '#' : 'o');
 #endif
-  delay(100);
-  lcd.setCursor(15,1);
-  lcd.print(' ');
+  flash_circle = 1;
+  flash_circle_time = tcount;
+  task_post_in(TASK_DISPLAY, FLASH_CIRCLE_TIME);
 }
 
 /**
  * Display a question on the first line with Yes / No options on the second
- * line.
+ * line. This is shown in S_CONFIRM.
  */
-void display_question(const char *question)
+void display_question(const char *q)
 {
-  strcpy(state.display.line_1, question);
-  strcpy(state.display.line_2, "RIT=No Keyer=Yes");
-  refresh_display();
+  question = q;
+  invalidate_display();
 }
 
 /**
@@ -358,6 +455,7 @@ void display_delay(short millis)
   lcd.setCursor(15,1);
   lcd.print('\0');
   for (int i = 0; i < 8; i++) {
+    watchdog_feed();
     delay(millis);
     loading_bar_char[i] = 0;
     lcd.createChar(0, loading_bar_char);
@@ -366,6 +464,63 @@ void display_delay(short millis)
   lcd.print(' ');
 }
 
+/**
+ * Report a watchdog reset on the second line, with the error code (if the
+ * reset was caused by error()) and the state the device was in. This remains
+ * visible for RESET_REPORT_TIME, unless the display is invalidated before.
+ * Until then, the echo of keyed characters is held back (see display_isr()).
+ */
+void display_reset_report(byte error, byte last_state)
+{
+  if (error)
+    sprintf(state.display.line_2, "Error %d S%d", error, last_state);
+  else
+    sprintf(state.display.line_2, "Reset S%d", last_state);
+  refresh_display();
+  reset_report = 1;
+  reset_report_time = tcount;
+  task_post_in(TASK_DISPLAY, RESET_REPORT_TIME);
+}
+
+/**
+ * Displays the number of queued memories as `+N` somewhere on the second line,
+ * if there are any.
+ */
+void display_queue(uint8_t start)
+{
+  if (!memory_queue_length())
+    return;
+  state.display.line_2[start - 1] = ' ';
+  state.display.line_2[start] = '+';
+  state.display.line_2[start + 1] = '0' + memory_queue_length();
+  state.display.line_2[start + 2] = '\0';
+}
+
+/**
+ * Displays the callsign for memories and the serial number on the second line.
+ */
+void display_call(void)
+{
+  uint8_t i;
+  unsigned int number = serial_number;
+
+  for (i = 0; i < CALLSIGN_LENGTH && callsign[i] != (byte) 0xff; i++)
+    state.display.line_2[i] = morse_to_ascii(callsign[i]);
+  if (i == 0) {
+    strcpy(state.display.line_2, "Call");
+    i = 4;
+  }
+  while (i < 11)
+    state.display.line_2[i++] = ' ';
+
+  state.display.line_2[11] = '#';
+  for (i = 15; i > 11; i--) {
+    state.display.line_2[i] = '0' + number % 10;
+    number /= 10;
+  }
+  state.display.line_2[16] = '\0';
+}
+
 /**
  * Displays the code speed in WPM on the second line, with arrows to change it.
  */
@@ -421,12 +576,49 @@ void display_rit(void)
 }
 
 /**
- * Displays the current frequency in kHz on the first line.
+ * Displays `A` or `B` for the active VFO, when VFO B is active or with split
+ * operation. With split operation, an arrow points to the TX VFO.
+ */
+void display_vfo(void)
+{
+  if (state.rit || (!state.split && !state.vfo))
+    return;
+
+  state.display.line_1[9] = ' ';
+  state.display.line_1[10] = 'A' + state.vfo;
+  if (state.split) {
+#ifdef OPT_USER_DEFINED_CHARACTERS
+    state.display.line_1[11] = '\7';
+#else
+    state.display.line_1[11] = '>';
+#endif
+    state.display.line_1[12] = 'A' + !state.vfo;
+    state.display.line_1[13] = '\0';
+  } else {
+    state.display.line_1[11] = '\0';
+  }
+}
+
+/**
+ * Displays the current frequency in kHz on the first line. With split
+ * operation this is the RX frequency, since that is what is tuned.
  * Blinks a digit when the tuning step is set large.
  */
 void display_freq(void)
 {
-  unsigned long frequency = TX_FREQ(state)/100;
+  display_freq_value(state.split ? state.op_freq : TX_FREQ(state));
+
+  state.display.blinking_1 |= tuning_blinks[state.tuning_step];
+  if (state.band == BAND_10)
+    state.display.blinking_1 <<= 1;
+}
+
+/**
+ * Displays a frequency in kHz on the first line.
+ */
+static void display_freq_value(unsigned long frequency)
+{
+  frequency /= 100;
 
   if (state.band == BAND_10) {
     state.display.line_1[0] = '0' + (frequency%10000000) / 1000000;
@@ -447,10 +639,29 @@ void display_freq(void)
   state.display.line_1[7] = 'H';
   state.display.line_1[8] = 'z';
   state.display.line_1[9] = '\0';
+}
 
-  state.display.blinking_1 |= tuning_blinks[state.tuning_step];
-  if (state.band == BAND_10)
-    state.display.blinking_1 <<= 1;
+/**
+ * Displays the frequency of the selected channel memory on the first line and
+ * the channel number on the second line.
+ */
+void display_channel(void)
+{
+  unsigned long frequency = channel_freq(channel_index);
+
+  state.display.blinking_1 = 0;
+  if (frequency == 0xfffffffful)
+    strcpy(state.display.line_1, "Empty");
+  else
+    display_freq_value(frequency);
+
+#ifdef OPT_USER_DEFINED_CHARACTERS
+  strcpy(state.display.line_2, "Channel \7..\6");
+#else
+  strcpy(state.display.line_2, "Channel <..>");
+#endif
+  state.display.line_2[9] = '0' + (channel_index + 1) / 10;
+  state.display.line_2[10] = '0' + (channel_index + 1) % 10;
 }
 
 /**
@@ -498,11 +709,7 @@ void display_dfe(void)
  */
 void display_band(uint8_t start)
 {
-  state.display.line_2[start  ] = BAND_DIGITS_1[state.band];
-  state.display.line_2[start+1] = BAND_DIGITS_2[state.band];
-  state.display.line_2[start+2] = BAND_DIGITS_3[state.band];
-  state.display.line_2[start+3] = BAND_DIGITS_4[state.band];
-  state.display.line_2[start+4] = '\0';
+  band_name(state.band, &state.display.line_2[start]);
 }
 
 // vim: tabstop=2 shiftwidth=2 expandtab:
@@ -34,12 +34,33 @@ struct key_state {
   unsigned char dot_time;
   unsigned int dash_time;
   unsigned int timer;
+  unsigned char busy:1; /* within a character, or the straight key is down */
+
+  /* Iambic keyer, see iambic_key() */
+  unsigned char phase:4;
+  unsigned char squeeze:1; /* whether the current dash alternates with dots */
+
+  /* Semi-break-in, see HANG_TIME */
+  unsigned char tx:1; /* whether the clocks are switched for TX */
+  unsigned char hang_expired:1;
+  unsigned int hang; /* remaining hang time, counted down by key_isr() */
+
+  /* Straight key decoder, see straight_key_decode() */
+  unsigned int straight_dot; /* estimated dot time in 1/16 ms */
+  unsigned char straight_char; /* character being decoded, 0 if none */
+  unsigned char straight_word:1; /* whether a word break may follow */
+  unsigned long straight_edge; /* time of the last edge */
 };
 
 void adjust_cs(byte);
 void load_cw_speed(void);
 byte key_active(void);
 void straight_key(void);
+void straight_key_decode(void);
+void straight_decoder_reset(void);
+void straight_decoder_down(unsigned long);
+void straight_decoder_up(unsigned long);
+void straight_decoder_poll(unsigned long);
 void key_isr(void);
 void iambic_key(void);
 
@@ -51,6 +72,7 @@ extern void key_handle_end(void);
 extern void key_handle_dash(void);
 extern void key_handle_dashdot_end(void);
 extern void key_handle_dot(void);
+extern void key_handle_decoded(byte);
 
 #ifdef __cplusplus
 }
@@ -23,10 +23,26 @@
 extern "C"{
 #endif
 
-static void dash(void);
+/* Phases of the iambic keyer, see iambic_key() */
+#define IAMBIC_IDLE          0
+#define IAMBIC_START         1
+#define IAMBIC_ELEMENTS      2
+#define IAMBIC_AFTER_DASH    3
+#define IAMBIC_AFTER_DOT     4
+#define IAMBIC_AFTER_SQUEEZE 5
+#define IAMBIC_WAIT          6
+#define IAMBIC_PAUSE_CHECK   7
+#define IAMBIC_PAUSE         8
+#define IAMBIC_DASH_MARK     9 /* the space must follow the mark */
+#define IAMBIC_DASH_SPACE   10
+#define IAMBIC_DOT_MARK     11
+#define IAMBIC_DOT_SPACE    12
+
+static void set_timer(unsigned int);
+static void dash(byte);
 static void dot(void);
-static void wait_check_dash(void);
-static void wait_check_dot(void);
+static void check_paddle(void);
+static void straight_decoder_update(unsigned long);
 
 /**
  * Change the paddle speed according to the parameter, withing the
@@ -68,141 +84,311 @@ byte key_active(void)
 
 /**
  * Handles a straight key. Simply calls straight_key_handle_enable() when it is
- * pressed, and straight_key_handle_disable() when it is released.
+ * pressed, and straight_key_handle_disable() when it is released. This does
+ * not block: it should be called on every edge of the key, and state.key.busy
+ * is set while the key is down.
  */
 void straight_key(void)
 {
-  if (digitalRead(DOTin) == HIGH)
+  byte down = digitalRead(DOTin) == LOW;
+
+  if (down == state.key.busy)
     return;
 
-  straight_key_handle_enable();
+  state.key.busy = down;
+  if (down)
+    straight_key_handle_enable();
+  else
+    straight_key_handle_disable();
+}
+
+/**
+ * Handles a straight key in states where the keyed characters are decoded
+ * rather than transmitted (e.g. DFE and memory entry). The edges of the key
+ * are passed to the decoder, and state.key.busy is set while the key is down.
+ * While a character or word break is pending, the keying task is posted on the
+ * next tick to poll the decoder. This should be called on every edge of the
+ * key.
+ * The sidetone is handled by key_handle_dot() and key_handle_dashdot_end();
+ * decoded characters are passed to key_handle_decoded().
+ */
+void straight_key_decode(void)
+{
+  byte down = digitalRead(DOTin) == LOW;
 
-  while (digitalRead(DOTin) == LOW)
-    delay(2);
+  if (down != state.key.busy) {
+    state.key.busy = down;
+    if (down) {
+      straight_decoder_down(tcount);
+      key_handle_dot();
+    } else {
+      straight_decoder_up(tcount);
+      key_handle_dashdot_end();
+    }
+  } else if (!down) {
+    straight_decoder_poll(tcount);
+  }
 
-  straight_key_handle_disable();
+  if (!down && (state.key.straight_char || state.key.straight_word))
+    task_post_in(TASK_KEYING, 1);
 }
 
 /**
- * The ISR for the keyer. Should be called every 1ms, to ensure proper timing.
+ * Reset the straight key decoder. The dot time estimate starts at the dot time
+ * of the keyer.
  */
-void key_isr(void)
+void straight_decoder_reset(void)
 {
-  if (state.key.timer > 0)
-    if (--state.key.timer == 0)
-      state.key.timeout = 1;
+  state.key.straight_dot = (unsigned int) state.key.dot_time << 4;
+  state.key.straight_char = 0;
+  state.key.straight_word = 0;
 }
 
 /**
- * Keys one character using the iambic keying method. This function only does
- * timing. What actually happens is defined by key_handle_dash(),
- * key_handle_dot() and key_handle_dashdot_end(), depending on the state.
+ * Update the dot time estimate of the straight key decoder with a running
+ * average (weight 1/8) of the new sample.
+ *
+ * @param sample the duration of a dot in ms.
  */
-void iambic_key(void)
+static void straight_decoder_update(unsigned long sample)
 {
-  byte repeat = 1;
+  if (sample > 1200u / KEY_MIN_SPEED)
+    sample = 1200u / KEY_MIN_SPEED;
+  state.key.straight_dot -= state.key.straight_dot >> 3;
+  state.key.straight_dot += sample << 1;
+}
 
-  if (digitalRead(DASHin) == HIGH && digitalRead(DOTin) == HIGH)
-    return;
+/**
+ * Handle a key down edge in the straight key decoder. This ends a space:
+ * a short space (< 2 dots) between elements is used to update the dot time
+ * estimate; longer spaces end the character (see straight_decoder_poll()).
+ *
+ * @param time the time of the edge in ms.
+ */
+void straight_decoder_down(unsigned long time)
+{
+  straight_decoder_poll(time);
 
-  key_handle_start();
-
-  while (repeat) {
-    state.key.timer = state.key.dash_time * 2;
-    state.key.timeout = 0;
-    do {
-      if (digitalRead(DASHin) == LOW)
-        dash();
-      if (digitalRead(DOTin) == LOW || state.key.dot)
-        dot();
-      while (state.key.dash) {
-        dash();
-        if (state.key.dot)
-          dot();
-      }
-      delay(1);
-    } while (!state.key.timeout);
-
-    state.key.timer = state.key.dash_time * 2;
-    state.key.timeout = 0;
-
-    repeat = 0;
-    do {
-      if (digitalRead(DASHin) == LOW || digitalRead(DOTin) == LOW) {
-        repeat = 1;
-        break;
-      }
-      delay(1);
-    } while (!state.key.timeout);
-  }
+  if (state.key.straight_char)
+    straight_decoder_update(time - state.key.straight_edge);
+  else
+    state.key.straight_char = 0x01;
 
-  key_handle_end();
+  state.key.straight_edge = time;
 }
 
 /**
- * Handle one dash. This function only does timing and iambic keying. What
- * actually happens is defined by key_handle_dash() and
- * key_handle_dashdot_end(), depending on the current state.
+ * Handle a key up edge in the straight key decoder. This ends a mark, which is
+ * a dot if it is shorter than 2 dots and a dash otherwise. The dot time
+ * estimate is updated accordingly.
+ *
+ * @param time the time of the edge in ms.
  */
-static void dash(void)
+void straight_decoder_up(unsigned long time)
 {
-  key_handle_dash();
-  state.key.dash = 0;
+  unsigned long mark = time - state.key.straight_edge;
+  byte dash = mark >= 2 * (state.key.straight_dot >> 4);
 
-  state.key.timer = state.key.dash_time;
-  state.key.timeout = 0;
-  wait_check_dot();
+  /* characters of more than 7 elements are kept >= 0x80, i.e. invalid */
+  if (state.key.straight_char < 0x80)
+    state.key.straight_char = (state.key.straight_char << 1) | dash;
 
-  key_handle_dashdot_end();
+  straight_decoder_update(dash ? mark / 3 : mark);
+  state.key.straight_edge = time;
+}
 
-  state.key.timer = state.key.dot_time;
+/**
+ * Check for the end of a character or word in the straight key decoder. This
+ * should be called regularly while the key is up. A space of 2 dots ends the
+ * character; a space of 5 dots ends the word. The character is passed to
+ * key_handle_decoded(); the end of a word is passed as 0x00.
+ *
+ * @param time the current time in ms.
+ */
+void straight_decoder_poll(unsigned long time)
+{
+  unsigned long space = time - state.key.straight_edge;
+  unsigned int dot = state.key.straight_dot >> 4;
+
+  if (state.key.straight_char && space >= 2 * dot) {
+    key_handle_decoded(state.key.straight_char);
+    state.key.straight_char = 0;
+    state.key.straight_word = 1;
+  }
+
+  if (state.key.straight_word && space >= 5 * dot) {
+    key_handle_decoded(0x00);
+    state.key.straight_word = 0;
+  }
+}
+
+/**
+ * The ISR for the keyer. Should be called every 1ms, to ensure proper timing.
+ * This also counts down the semi-break-in hang timer; RX is enabled again by
+ * hang_poll(), since the Si5351 cannot be accessed from an interrupt.
+ */
+void key_isr(void)
+{
+  if (state.key.timer > 0)
+    if (--state.key.timer == 0)
+      state.key.timeout = 1;
+  if (state.key.hang > 0)
+    if (--state.key.hang == 0)
+      state.key.hang_expired = 1;
+}
+
+/**
+ * Start waiting for a key timeout (see key_isr()).
+ */
+static void set_timer(unsigned int time)
+{
+  state.key.timer = time;
   state.key.timeout = 0;
-  wait_check_dot();
 }
 
 /**
- * Wait for a key timeout and update the dot status.
+ * Keys characters using the iambic keying method. This function only does
+ * timing. What actually happens is defined by key_handle_start(),
+ * key_handle_dash(), key_handle_dot(), key_handle_dashdot_end() and
+ * key_handle_end(), depending on the state.
+ *
+ * This does not block. It runs one step of the keyer and returns, and should
+ * be called when the paddle is touched and then on every tick as long as
+ * state.key.busy is set, i.e. until the end of the character. A character ends
+ * when the paddle has not been touched for two dash times after the last
+ * element.
  */
-static void wait_check_dot(void)
+void iambic_key(void)
 {
-  do {
-    if (digitalRead(DOTin) == LOW)
-      state.key.dot = 1;
-    delay(1);
-  } while (!state.key.timeout);
+  for (;;) {
+    switch (state.key.phase) {
+      case IAMBIC_IDLE:
+        if (digitalRead(DASHin) == HIGH && digitalRead(DOTin) == HIGH)
+          return;
+        key_handle_start();
+        state.key.busy = 1;
+        /* fall through */
+      case IAMBIC_START:
+        set_timer(state.key.dash_time * 2);
+        /* fall through */
+      case IAMBIC_ELEMENTS:
+        if (digitalRead(DASHin) == LOW) {
+          dash(IAMBIC_AFTER_DASH);
+          return;
+        }
+        /* fall through */
+      case IAMBIC_AFTER_DASH:
+        if (digitalRead(DOTin) == LOW || state.key.dot) {
+          dot();
+          return;
+        }
+        /* fall through */
+      case IAMBIC_AFTER_DOT:
+        if (state.key.dash) {
+          dash(IAMBIC_AFTER_SQUEEZE);
+          return;
+        }
+        state.key.phase = IAMBIC_WAIT;
+        return;
+      case IAMBIC_AFTER_SQUEEZE:
+        if (state.key.dot) {
+          dot();
+          return;
+        }
+        state.key.phase = IAMBIC_AFTER_DOT;
+        continue;
+      case IAMBIC_WAIT:
+        if (!state.key.timeout) {
+          state.key.phase = IAMBIC_ELEMENTS;
+          continue;
+        }
+        set_timer(state.key.dash_time * 2);
+        /* fall through */
+      case IAMBIC_PAUSE_CHECK:
+        if (digitalRead(DASHin) == LOW || digitalRead(DOTin) == LOW) {
+          state.key.phase = IAMBIC_START;
+          continue;
+        }
+        state.key.phase = IAMBIC_PAUSE;
+        return;
+      case IAMBIC_PAUSE:
+        if (!state.key.timeout) {
+          state.key.phase = IAMBIC_PAUSE_CHECK;
+          continue;
+        }
+        state.key.phase = IAMBIC_IDLE;
+        state.key.busy = 0;
+        key_handle_end();
+        return;
+      case IAMBIC_DASH_MARK:
+      case IAMBIC_DOT_MARK:
+        if (state.key.timeout) {
+          key_handle_dashdot_end();
+          set_timer(state.key.dot_time);
+          state.key.phase++; /* to the space */
+        }
+        check_paddle();
+        return;
+      case IAMBIC_DASH_SPACE:
+        if (state.key.timeout) {
+          state.key.phase = state.key.squeeze ? IAMBIC_AFTER_SQUEEZE : IAMBIC_AFTER_DASH;
+          continue;
+        }
+        check_paddle();
+        return;
+      case IAMBIC_DOT_SPACE:
+        if (state.key.timeout) {
+          state.key.phase = IAMBIC_AFTER_DOT;
+          continue;
+        }
+        check_paddle();
+        return;
+    }
+  }
 }
 
 /**
- * Handle one dot. This function only does timing and iambic keying. What
- * actually happens is defined by key_handle_dot() and
+ * Start a dash. This function only does timing and iambic keying. What
+ * actually happens is defined by key_handle_dash() and
  * key_handle_dashdot_end(), depending on the current state.
+ *
+ * @param next the phase to continue with after the dash and the space.
+ */
+static void dash(byte next)
+{
+  key_handle_dash();
+  state.key.dash = 0;
+  state.key.squeeze = next == IAMBIC_AFTER_SQUEEZE;
+  set_timer(state.key.dash_time);
+  state.key.phase = IAMBIC_DASH_MARK;
+  check_paddle();
+}
+
+/**
+ * Start a dot. See dash().
  */
 static void dot(void)
 {
   key_handle_dot();
   state.key.dot = 0;
-
-  state.key.timer = state.key.dot_time;
-  state.key.timeout = 0;
-  wait_check_dash();
-
-  key_handle_dashdot_end();
-
-  state.key.timer = state.key.dot_time;
-  state.key.timeout = 0;
-  wait_check_dash();
+  set_timer(state.key.dot_time);
+  state.key.phase = IAMBIC_DOT_MARK;
+  check_paddle();
 }
 
 /**
- * Wait for a key timeout and update the dash status.
+ * During a dash, remember whether the dot paddle was touched, and vice versa,
+ * so that the other element follows.
  */
-static void wait_check_dash(void)
+static void check_paddle(void)
 {
-  do {
+  if (state.key.phase <= IAMBIC_DASH_SPACE) {
+    if (digitalRead(DOTin) == LOW)
+      state.key.dot = 1;
+  } else {
     if (digitalRead(DASHin) == LOW)
       state.key.dash = 1;
-    delay(1);
-  } while (!state.key.timeout);
+  }
 }
 
 #ifdef __cplusplus
@@ -20,11 +20,75 @@
 
 #include "ATSAMF.h"
 
-void store_memory(byte);
+/* Tokens in memories, which are expanded when the memory is transmitted. */
+#define TOKEN_SERIAL 0b10011 // ..--: serial number
+#define TOKEN_CALL   0b11110 // ---.: last entered callsign
+#define TOKEN_MEMORY 0b11111 // ----: another memory, followed by its number
+
+/* The memories are stored in chains of MEMORY_BLOCK bytes, so that a memory
+ * can use the space that shorter memories leave free. The blocks fill the ten
+ * slots of MEMORY_LENGTH before the channel memories and the space after them,
+ * up to the link table and the index at the end of EEPROM. The index holds the
+ * first block of each memory and the link table the next block of each block.
+ * An erased index entry maps memory n to the start of its slot, and an erased
+ * link maps block b to block b + 1 within a slot and ends the memory at the end
+ * of the slot, so that memories stored in the slots are still found. Memories
+ * end with 0xff, or at the end of their slot when it is full. */
+#define MEMORY_COUNT       10
+#define MEMORY_BLOCK       16
+#define MEMORY_MAX_LENGTH  255
+#define MEMORY_LOW_BLOCKS  (MEMORY_COUNT * MEMORY_LENGTH / MEMORY_BLOCK)
+#define MEMORY_HIGH_BLOCKS ((MEMORY_INDEX_START - CHANNEL_EEPROM_END - \
+      MEMORY_LOW_BLOCKS) / (MEMORY_BLOCK + 1))
+#define MEMORY_BLOCKS      (MEMORY_LOW_BLOCKS + MEMORY_HIGH_BLOCKS)
+#define MEMORY_LINK_START  (MEMORY_INDEX_START - MEMORY_BLOCKS)
+#define MEMORY_INDEX_START (E2END + 1 - MEMORY_COUNT)
+
+#define MEMORY_PAGE       8 /* Characters buffered in RAM by the recorder */
+#define MEMORY_WRITE_TIME 4 /* Time to write a byte to EEPROM in ms */
+#define MEMORY_NESTING    3 /* Maximum depth of memory references */
+#define MEMORY_QUEUE      4 /* Maximum number of memories queued for TX */
+#define CALLSIGN_LENGTH   10
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern unsigned int serial_number;
+extern byte callsign[CALLSIGN_LENGTH];
+
 void transmit_memory(byte);
-void playback_buffer(void);
-void prepare_buffer_for_tx(void);
-void empty_buffer(void);
+
+void memory_record_start(void);
+byte memory_record_add(byte);
+byte memory_record_break(void);
+byte memory_record_full(void);
+void memory_record_flush(void);
+void memory_record_playback(void);
+void memory_record_playback_next(void);
+void memory_record_commit(byte);
+
+void memory_tx_start(byte);
+void memory_tx_repeat(byte);
+byte memory_tx_next(void);
+void memory_tx_end(void);
+void memory_tx_cancel(void);
+
+byte memory_queue_add(byte);
+byte memory_queue_next(void);
+byte memory_queue_length(void);
+void memory_queue_clear(void);
+
+void load_serial(void);
+void serial_adjust(int8_t);
+void serial_flush(void);
+
+void callsign_clear(void);
+void callsign_add(byte);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
@@ -17,74 +17,624 @@
 
 #include "memory.h"
 
+#if MEMORY_LENGTH % MEMORY_BLOCK
+# error "MEMORY_LENGTH must be a multiple of MEMORY_BLOCK"
+#endif
+#if MEMORY_INDEX_START < CHANNEL_EEPROM_END + MEMORY_LOW_BLOCKS
+# error "The message memories do not fit in EEPROM; decrease MEMORY_LENGTH or CHANNEL_COUNT"
+#endif
+
+/**
+ * Where the characters of a memory that is being transmitted come from. The
+ * memory itself is read from EEPROM directly; tokens push a new source on the
+ * stack, which is popped when it runs out of characters.
+ */
+enum memory_source
+#ifdef __cplusplus
+  : unsigned char
+#endif
+  {
+  SOURCE_MEMORY,
+  SOURCE_SERIAL,
+  SOURCE_CALL
+};
+
+struct memory_cursor {
+  enum memory_source source;
+  byte memory;
+  byte index;
+};
+
+static struct memory_cursor tx_stack[MEMORY_NESTING + 2];
+static byte tx_depth = 0;
+static byte tx_serial_used;
+static byte tx_repeat;
+
+/**
+ * Memories queued for TX, in a ring buffer.
+ */
+static byte memory_queue[MEMORY_QUEUE];
+static byte memory_queue_head = 0;
+static byte memory_queue_count = 0;
+
+unsigned int serial_number;
+static byte serial_dirty = 0;
+
+byte callsign[CALLSIGN_LENGTH];
+
 /**
- * Store the buffer in EEPROM.
+ * The recorder for new memories. Keyed characters are collected in a page
+ * buffer in RAM, which memory_record_flush() writes to free blocks in EEPROM
+ * while the key is up. The page holds the last MEMORY_PAGE characters, also
+ * after they have been written. The blocks are allocated while recording, so
+ * that there is always room for the end marker.
+ */
+static byte record_blocks[MEMORY_MAX_LENGTH / MEMORY_BLOCK + 1];
+static byte record_block_count;
+static byte record_linked; /* the number of blocks linked to the next */
+static byte record_used[(MEMORY_BLOCKS + 7) / 8];
+static byte record_length;
+static byte record_written;
+static byte record_page[MEMORY_PAGE];
+static byte record_played;
+
+static int block_address(byte block)
+{
+  if (block < MEMORY_LOW_BLOCKS)
+    return MEMORY_EEPROM_START + block * MEMORY_BLOCK;
+  else
+    return CHANNEL_EEPROM_END + (block - MEMORY_LOW_BLOCKS) * MEMORY_BLOCK;
+}
+
+/**
+ * Get the block after a block of a memory (see MEMORY_LINK_START). An erased
+ * link continues with the next block of the same slot of MEMORY_LENGTH, and
+ * ends the memory at the end of the slot, because a memory stored in a slot
+ * before the links were introduced has no end marker when it fills the slot.
  *
- * @param nr the index to store the message in.
+ * @return the next block, or 0xff at the end of the memory.
  */
-void store_memory(byte nr)
+static byte block_next(byte block)
 {
-  int addr = MEMORY_EEPROM_START + nr * MEMORY_LENGTH;
-  for (byte i = 0; i < MEMORY_LENGTH; i++)
-    EEPROM.write(addr++, buffer[i]);
+  byte next = EEPROM.read(MEMORY_LINK_START + block);
+  if (next < MEMORY_BLOCKS)
+    return next;
+  return (block + 1) % (MEMORY_LENGTH / MEMORY_BLOCK) ? block + 1 : 0xff;
 }
 
 /**
- * Load a message memory from EEPROM into the RAM buffer.
+ * Get the first block of a memory (see MEMORY_INDEX_START).
+ */
+static byte memory_block(byte nr)
+{
+  byte block = EEPROM.read(MEMORY_INDEX_START + nr);
+  return block < MEMORY_BLOCKS ? block : nr * (MEMORY_LENGTH / MEMORY_BLOCK);
+}
+
+/**
+ * Read a character from a message memory in EEPROM.
  *
- * @param nr the index of the message to load.
+ * @return the character, or 0xff beyond the end of the memory.
  */
-void load_memory(byte nr)
+static byte memory_read(byte nr, byte index)
 {
-  int addr = MEMORY_EEPROM_START + nr * MEMORY_LENGTH;
-  for (byte i = 0; i < MEMORY_LENGTH; i++)
-    buffer[i] = EEPROM.read(addr++);
+  byte block = memory_block(nr);
+
+  for (byte n = index / MEMORY_BLOCK; n; n--)
+    if ((block = block_next(block)) >= MEMORY_BLOCKS)
+      return 0xff;
+  return EEPROM.read(block_address(block) + index % MEMORY_BLOCK);
 }
 
 /**
- * Prepare the buffer to transmit. This replaces all 0x00 (space) and 0xff
- * (empty) from the end of the buffer with 0xff, s.t. the first 0xff that is
- * encountered from the start of the buffer marks the end of the message.
+ * Check whether a memory contains only word breaks from some index, so that
+ * trailing word breaks are not transmitted (compare prepare_buffer_for_tx()).
  */
-void prepare_buffer_for_tx()
+static byte memory_rest_empty(byte nr, byte index)
 {
-  for (byte i = MEMORY_LENGTH - 1; i; i--) {
-    if (buffer[i] != 0x00 && buffer[i] != (char)0xff)
-      return;
-    buffer[i] = 0xff;
+  for (; index < MEMORY_MAX_LENGTH; index++) {
+    byte character = memory_read(nr, index);
+    if (character == 0xff)
+      return 1;
+    else if (character != 0x00)
+      return 0;
   }
+  return 1;
 }
 
 /**
- * Plays the message buffer on the sidetone. This function only takes care of
- * timing. What actually happens is defined by key_handle_* functions.
- * See also morse() for a single character.
+ * Get a digit of the serial number. At least three digits are sent. With
+ * OPT_CUT_NUMBERS, 0 and 9 are sent as T and N.
+ *
+ * @return the digit, or 0xff beyond the last digit.
  */
-void playback_buffer(void)
+static byte serial_digit(byte index)
 {
-  prepare_buffer_for_tx();
+  unsigned int number = serial_number;
+  byte digits = number >= 1000 ? 4 : 3;
+
+  if (index >= digits)
+    return 0xff;
+  for (byte i = digits - 1; i > index; i--)
+    number /= 10;
 
-  key_handle_start();
-  for (byte i = 0; i < MEMORY_LENGTH; i++) {
-    byte character = buffer[i];
-    if (character == 0x00) {
-      delay(state.key.dot_time);
-    } else if (character == 0xff) {
-      key_handle_end();
+  switch (number % 10) {
+#ifdef OPT_CUT_NUMBERS
+    case 0: return MT;
+    case 9: return MN;
+#endif
+    default: return MORSE_DIGITS[number % 10];
+  }
+}
+
+/**
+ * Get the next character of a source (see memory_source).
+ */
+static byte cursor_next(struct memory_cursor *cursor)
+{
+  byte index = cursor->index++;
+
+  switch (cursor->source) {
+    case SOURCE_MEMORY:
+      return memory_read(cursor->memory, index);
+    case SOURCE_SERIAL:
+      return serial_digit(index);
+    case SOURCE_CALL:
+      return index < CALLSIGN_LENGTH ? callsign[index] : 0xff;
+  }
+  return 0xff;
+}
+
+static void tx_push(enum memory_source source, byte memory)
+{
+  tx_stack[tx_depth].source = source;
+  tx_stack[tx_depth].memory = memory;
+  tx_stack[tx_depth].index = 0;
+  tx_depth++;
+}
+
+/**
+ * Start transmitting a message memory (see memory_tx_next()).
+ *
+ * @param nr the index of the message to transmit.
+ */
+void memory_tx_start(byte nr)
+{
+  tx_depth = 0;
+  tx_serial_used = 0;
+  tx_repeat = 0;
+  tx_push(SOURCE_MEMORY, nr);
+}
+
+/**
+ * Start transmitting a message memory again in beacon mode. This is like
+ * memory_tx_start(), but the serial number is not incremented at the end.
+ *
+ * @param nr the index of the message to transmit.
+ */
+void memory_tx_repeat(byte nr)
+{
+  memory_tx_start(nr);
+  tx_repeat = 1;
+}
+
+/**
+ * Get the next character to transmit from the memory set up with
+ * memory_tx_start(). Tokens are expanded as they are encountered, so that no
+ * copy of the expanded message is needed:
+ *
+ * - TOKEN_SERIAL is replaced with the serial number (see serial_digit()).
+ * - TOKEN_CALL is replaced with the callsign entered in S_CALL_ENTER.
+ * - TOKEN_MEMORY followed by a number is replaced with that memory, up to a
+ *   depth of MEMORY_NESTING. Deeper references are skipped.
+ *
+ * @return the character, 0x00 for a word break, or 0xff at the end.
+ */
+byte memory_tx_next(void)
+{
+  while (tx_depth) {
+    struct memory_cursor *cursor = &tx_stack[tx_depth - 1];
+    byte character = cursor_next(cursor);
+
+    if (character == 0xff) {
+      tx_depth--;
+      continue;
+    } else if (cursor->source != SOURCE_MEMORY) {
+      return character;
+    }
+
+    switch (character) {
+      case 0x00:
+        if (memory_rest_empty(cursor->memory, cursor->index)) {
+          tx_depth--;
+          continue;
+        }
+        return 0x00;
+      case TOKEN_SERIAL:
+        tx_serial_used = 1;
+        tx_push(SOURCE_SERIAL, 0);
+        continue;
+      case TOKEN_CALL:
+        tx_push(SOURCE_CALL, 0);
+        continue;
+      case TOKEN_MEMORY:
+        character = morse_digit(cursor_next(cursor));
+        if (character != 0xff && tx_depth <= MEMORY_NESTING)
+          tx_push(SOURCE_MEMORY, character);
+        continue;
+      default:
+        return character;
+    }
+  }
+
+  return 0xff;
+}
+
+/**
+ * Finish transmitting a memory after it was sent completely. When the serial
+ * number was sent, it is incremented, unless this was a beacon repeat (see
+ * memory_tx_repeat()). It is written to EEPROM later by serial_flush(), so
+ * that this does not delay transmission.
+ */
+void memory_tx_end(void)
+{
+  if (tx_serial_used && !tx_repeat)
+    serial_adjust(1);
+  memory_tx_cancel();
+}
+
+/**
+ * Stop transmitting a memory before the end, e.g. on break-in. The serial
+ * number is not incremented, since the exchange was not completed.
+ */
+void memory_tx_cancel(void)
+{
+  tx_serial_used = 0;
+  tx_depth = 0;
+}
+
+/**
+ * Add a memory to the TX queue.
+ *
+ * @return 0 if the queue is full, 1 otherwise.
+ */
+byte memory_queue_add(byte nr)
+{
+  if (memory_queue_count == MEMORY_QUEUE)
+    return 0;
+  memory_queue[(memory_queue_head + memory_queue_count++) % MEMORY_QUEUE] = nr;
+  return 1;
+}
+
+/**
+ * Remove the next memory from the TX queue.
+ *
+ * @return the index of the memory, or 0xff if the queue is empty.
+ */
+byte memory_queue_next(void)
+{
+  byte nr;
+
+  if (!memory_queue_count)
+    return 0xff;
+  nr = memory_queue[memory_queue_head];
+  memory_queue_head = (memory_queue_head + 1) % MEMORY_QUEUE;
+  memory_queue_count--;
+  return nr;
+}
+
+/**
+ * The number of memories in the TX queue.
+ */
+byte memory_queue_length(void)
+{
+  return memory_queue_count;
+}
+
+/**
+ * Empty the TX queue.
+ */
+void memory_queue_clear(void)
+{
+  memory_queue_count = 0;
+}
+
+/**
+ * Load the serial number from EEPROM. It starts at 1.
+ */
+void load_serial(void)
+{
+  serial_number =                        EEPROM.read(EEPROM_SERIAL + 1);
+  serial_number = (serial_number << 8) + EEPROM.read(EEPROM_SERIAL + 0);
+  if (serial_number == 0 || serial_number > 9999)
+    serial_number = 1;
+}
+
+/**
+ * Adjust the serial number, between 1 and 9999.
+ */
+void serial_adjust(int8_t offset)
+{
+  serial_number += offset;
+  if (serial_number == 0)
+    serial_number = 9999;
+  else if (serial_number > 9999)
+    serial_number = 1;
+  serial_dirty = 1;
+}
+
+/**
+ * Write the serial number to EEPROM if it has changed. This should be called
+ * when idle.
+ */
+void serial_flush(void)
+{
+  if (!serial_dirty)
+    return;
+  EEPROM.write(EEPROM_SERIAL + 0, serial_number);
+  EEPROM.write(EEPROM_SERIAL + 1, serial_number >> 8);
+  serial_dirty = 0;
+}
+
+/**
+ * Clear the callsign.
+ */
+void callsign_clear(void)
+{
+  for (byte i = 0; i < CALLSIGN_LENGTH; i++)
+    callsign[i] = 0xff;
+}
+
+/**
+ * Add a character to the callsign. Characters beyond CALLSIGN_LENGTH are
+ * ignored.
+ */
+void callsign_add(byte character)
+{
+  for (byte i = 0; i < CALLSIGN_LENGTH; i++) {
+    if (callsign[i] == 0xff) {
+      callsign[i] = character;
       return;
     }
-    morse(character);
   }
-  key_handle_end();
+}
+
+static byte block_used(byte block)
+{
+  return record_used[block / 8] & (1 << (block % 8));
+}
+
+/**
+ * Mark the blocks of a memory as used, up to the block with the end marker.
+ */
+static void mark_used(byte nr)
+{
+  byte block = memory_block(nr);
+
+  for (byte n = 0; n <= MEMORY_MAX_LENGTH / MEMORY_BLOCK && block < MEMORY_BLOCKS; n++) {
+    int address = block_address(block);
+
+    record_used[block / 8] |= 1 << (block % 8);
+    for (byte i = 0; i < MEMORY_BLOCK; i++)
+      if (EEPROM.read(address + i) == 0xff)
+        return;
+    block = block_next(block);
+  }
+}
+
+/**
+ * Allocate a free block for the recording. The block after the last one is
+ * preferred, so that no link needs to be written within a slot (see
+ * block_next()).
+ *
+ * @return 0 if there is no free block, 1 otherwise.
+ */
+static byte record_allocate(void)
+{
+  byte block = record_block_count ? record_blocks[record_block_count - 1] + 1 : 0;
+
+  for (byte n = 0; n < MEMORY_BLOCKS; n++, block++) {
+    if (block >= MEMORY_BLOCKS)
+      block = 0;
+    if (!block_used(block)) {
+      record_used[block / 8] |= 1 << (block % 8);
+      record_blocks[record_block_count++] = block;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Start recording a new memory in the blocks that are not used by any memory.
+ * The memory that is replaced keeps its blocks until memory_record_commit().
+ */
+void memory_record_start(void)
+{
+  for (byte i = 0; i < sizeof(record_used); i++)
+    record_used[i] = 0;
+  for (byte nr = 0; nr < MEMORY_COUNT; nr++)
+    mark_used(nr);
+
+  record_block_count = 0;
+  record_linked = 0;
+  record_length = 0;
+  record_written = 0;
+  record_allocate();
+}
+
+static int record_address(byte index)
+{
+  return block_address(record_blocks[index / MEMORY_BLOCK]) + index % MEMORY_BLOCK;
+}
+
+/**
+ * Link the blocks of the recording up to the block of an index. Links are only
+ * written when they do not point to the right block already.
+ *
+ * @return 1 if a link was written, 0 if the blocks are linked.
+ */
+static byte record_link(byte index)
+{
+  while (record_linked < index / MEMORY_BLOCK) {
+    byte block = record_blocks[record_linked];
+    byte next = record_blocks[++record_linked];
+    if (block_next(block) != next) {
+      EEPROM.write(MEMORY_LINK_START + block, next);
+      return 1;
+    }
+  }
+  return 0;
 }
 
 /**
- * Clear the message buffer.
+ * Write the next recorded character to EEPROM. This blocks when the EEPROM is
+ * still busy with a previous write.
  */
-void empty_buffer(void)
+static void record_write_next(void)
 {
-  for (byte i = 0; i < MEMORY_LENGTH; i++)
-    buffer[i] = 0xff;
+  while (record_link(record_written))
+    ;
+  EEPROM.write(record_address(record_written),
+      record_page[record_written % MEMORY_PAGE]);
+  record_written++;
+}
+
+/**
+ * Get a recorded character, from the page buffer if it has not been written
+ * yet.
+ */
+static byte record_read(byte index)
+{
+  if (index >= record_written)
+    return record_page[index % MEMORY_PAGE];
+  return EEPROM.read(record_address(index));
+}
+
+/**
+ * Add a character to the recording. The character is written to EEPROM later
+ * by memory_record_flush(), unless the page buffer is full.
+ *
+ * @return 0 if the memory is full, 1 otherwise.
+ */
+byte memory_record_add(byte character)
+{
+  if (memory_record_full())
+    return 0;
+  if (record_length - record_written == MEMORY_PAGE)
+    record_write_next();
+
+  record_page[record_length++ % MEMORY_PAGE] = character;
+  if (record_length < MEMORY_MAX_LENGTH &&
+      (record_length + 1) / MEMORY_BLOCK >= record_block_count)
+    record_allocate();
+  task_post(TASK_EEPROM);
+  return 1;
+}
+
+/**
+ * Add a word break to the recording. No word breaks are recorded at the start
+ * or after another word break.
+ *
+ * @return 1 if the word break was recorded, 0 otherwise.
+ */
+byte memory_record_break(void)
+{
+  if (record_length == 0 || record_page[(record_length - 1) % MEMORY_PAGE] == 0x00)
+    return 0;
+  return memory_record_add(0x00);
+}
+
+/**
+ * Check whether the recording is full: it has MEMORY_MAX_LENGTH characters, or
+ * there is no free block for the end marker after another character.
+ */
+byte memory_record_full(void)
+{
+  return record_length == MEMORY_MAX_LENGTH ||
+    (record_length + 1) / MEMORY_BLOCK >= record_block_count;
+}
+
+/**
+ * Write the recording to EEPROM. This does not block: a character is only
+ * written when the EEPROM is ready and the key is up. While the EEPROM is busy,
+ * the EEPROM task is posted again after MEMORY_WRITE_TIME. While the key is
+ * down, nothing is written; the flush continues when the EEPROM task is posted
+ * by the next character or periodically by tasks_isr().
+ */
+void memory_record_flush(void)
+{
+  if (record_written == record_length || key_active())
+    return;
+  if (eeprom_is_ready() && !record_link(record_written))
+    record_write_next();
+  if (record_written != record_length)
+    task_post_in(TASK_EEPROM, MEMORY_WRITE_TIME);
+}
+
+/**
+ * Get the length of the recording without trailing word breaks.
+ */
+static byte record_trimmed_length(void)
+{
+  byte length = record_length;
+  while (length && record_read(length - 1) == 0x00)
+    length--;
+  return length;
+}
+
+/**
+ * Play the recording on the sidetone. This does not block: the first character
+ * is started with morse_send(), and the others are sent by
+ * memory_record_playback_next().
+ */
+void memory_record_playback(void)
+{
+  record_played = 0;
+  memory_record_playback_next();
+}
+
+/**
+ * Send the next character of the recording that is played back (see
+ * memory_record_playback()). This should be called from the keying task when
+ * the previous character has been sent. A word break is played as 4 dot times
+ * of silence.
+ */
+void memory_record_playback_next(void)
+{
+  byte character;
+
+  if (record_played >= record_trimmed_length())
+    return;
+
+  character = record_read(record_played++);
+  if (character == 0x00)
+    morse_pause(state.key.dot_time + state.key.dash_time, 0);
+  else
+    morse_send(character, 0);
+}
+
+/**
+ * Store the recording as a memory. The remaining characters, links and the end
+ * marker are written to the recording blocks, after which the memory is
+ * switched to these blocks by a single (thus atomic) write to the index. The
+ * blocks of the memory stored before become free for the next recording.
+ */
+void memory_record_commit(byte nr)
+{
+  byte length = record_trimmed_length();
+
+  if (!record_block_count)
+    return;
+  while (record_written < length)
+    record_write_next();
+  while (record_link(length))
+    ;
+  EEPROM.write(record_address(length), 0xff);
+  EEPROM.write(MEMORY_INDEX_START + nr, record_blocks[0]);
+
+  record_length = 0;
+  record_written = 0;
 }
 
 // vim: tabstop=2 shiftwidth=2 expandtab:
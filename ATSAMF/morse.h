@@ -60,8 +60,22 @@
 
 #define Mquestion 0b1001100 // ?
 
+#define MORSE_QUEUE 4 /* Characters queued by morse() */
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
 extern const byte MORSE_DIGITS[];
 
+byte morse_digit(byte);
+void morse_send(byte, byte);
+void morse_pause(unsigned int, byte);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
 // vim: tabstop=2 shiftwidth=2 expandtab:
@@ -20,32 +20,218 @@
 const byte MORSE_DIGITS[] = {M0,M1,M2,M3,M4,M5,M6,M7,M8,M9};
 
 /**
- * Key out a character. This function only takes care of timing. What actually
- * happens is defined by the key_handle_* functions, according to the state.
+ * ASCII equivalents of morse characters, indexed by the morse representation
+ * (see morse.h). Unknown characters are '*'.
+ */
+static const char MORSE_ASCII[] PROGMEM =
+  "**ETIANMSURWDKGO" /*   0 */
+  "HVF*L*PJBXCYZQ**" /*  16 */
+  "54*3***2**+****1" /*  32 */
+  "6=/*****7***8*90" /*  48 */
+  "************?***" /*  64 */
+  "*****.**********" /*  80 */
+  "****************" /*  96 */
+  "***,************" /* 112 */;
+
+/**
+ * Decode a morse character to ASCII.
  *
- * @param character the character to send.
+ * @param character the morse character.
+ * @return the ASCII character, or '*' if it is unknown.
  */
-void morse(byte character)
+char morse_to_ascii(byte character)
 {
-  char i;
+  if (character >= sizeof(MORSE_ASCII) - 1)
+    return '*';
+  return pgm_read_byte(&MORSE_ASCII[character]);
+}
 
-  for (i = 7; i >= 0; i--)
-    if (character & (1 << i))
+/**
+ * Parse a digit. The abbreviations T and N can be used for 0 and 9, and, with
+ * OPT_OBSCURE_MORSE_ABBREVIATIONS, those for the other digits as well.
+ *
+ * @param character the morse character.
+ * @return the value of the digit, or 0xff if it is not a digit.
+ */
+byte morse_digit(byte character)
+{
+  switch (character) {
+    case M0: case MT: return 0;
+#ifdef OPT_OBSCURE_MORSE_ABBREVIATIONS
+    case M1: case MA: return 1;
+    case M2: case MU: return 2;
+    case M3: case MW: return 3;
+    case M4: case MV: return 4;
+    case M5: case MS: return 5;
+    case M6: case MB: return 6;
+    case M7: case MG: return 7;
+    case M8: case MD: return 8;
+#else
+    case M1: return 1;
+    case M2: return 2;
+    case M3: return 3;
+    case M4: return 4;
+    case M5: return 5;
+    case M6: return 6;
+    case M7: return 7;
+    case M8: return 8;
+#endif
+    case M9: case MN: return 9;
+    default: return 0xff;
+  }
+}
+
+/* Phases of the sender, see morse_poll() */
+#define MORSE_IDLE  0
+#define MORSE_MARK  1
+#define MORSE_SPACE 2 /* between elements */
+#define MORSE_END   3 /* after the last element, or a pause */
+
+static byte morse_phase = MORSE_IDLE;
+static byte morse_character; /* the character that is being sent */
+static char morse_element; /* the bit of the current element */
+static byte morse_break_in; /* whether to stop when the key is touched */
+static unsigned long morse_end; /* the end of the current phase (tcount) */
+
+/* Characters queued by morse() */
+static byte morse_queue[MORSE_QUEUE];
+static byte morse_queued = 0;
+
+/**
+ * Wait for some time in a phase of the sender.
+ */
+static void morse_wait(byte phase, unsigned int time)
+{
+  morse_phase = phase;
+  morse_end = tcount + time;
+}
+
+/**
+ * Start the next element of the character, or the space after the character.
+ */
+static void morse_next_element(void)
+{
+  if (--morse_element < 0) {
+    morse_wait(MORSE_END, state.key.dash_time);
+  } else if (morse_character & (1 << morse_element)) {
+    key_handle_dash();
+    morse_wait(MORSE_MARK, state.key.dash_time);
+  } else {
+    key_handle_dot();
+    morse_wait(MORSE_MARK, state.key.dot_time);
+  }
+}
+
+/**
+ * Start sending a character. This function only takes care of timing. What
+ * actually happens is defined by the key_handle_* functions, according to the
+ * state. Each element is followed by a dot time of space, and the character by
+ * another dash time.
+ * This does not block: the character is sent by morse_poll(), and
+ * state.key.busy is set until it has been sent.
+ *
+ * @param character the character to send.
+ * @param break_in whether to stop as soon as the paddle or straight key is
+ *   touched. An element that is being sent is then cut off.
+ */
+void morse_send(byte character, byte break_in)
+{
+  morse_character = character;
+  for (morse_element = 7; morse_element >= 0; morse_element--)
+    if (character & (1 << morse_element))
       break;
+  morse_break_in = break_in;
+  state.key.busy = 1;
+  morse_next_element();
+}
 
-  for (i--; i >= 0; i--) {
-    if (character & (1 << i)) {
-      key_handle_dash();
-      delay(state.key.dash_time);
-    } else {
-      key_handle_dot();
-      delay(state.key.dot_time);
-    }
+/**
+ * Wait for some time, like delay(), but without blocking (see morse_send()).
+ *
+ * @param time the time to wait in ms.
+ * @param break_in whether to stop as soon as the paddle or straight key is
+ *   touched.
+ */
+void morse_pause(unsigned int time, byte break_in)
+{
+  morse_break_in = break_in;
+  state.key.busy = 1;
+  morse_wait(MORSE_END, time);
+}
+
+/**
+ * Key out a character as feedback to the user (see morse_send()). When another
+ * character is being sent, the character is queued; when the queue is full, it
+ * is dropped.
+ *
+ * @param character the character to send.
+ */
+void morse(byte character)
+{
+  if (morse_phase == MORSE_IDLE)
+    morse_send(character, 0);
+  else if (morse_queued < MORSE_QUEUE)
+    morse_queue[morse_queued++] = character;
+}
+
+/**
+ * Stop sending immediately, and clear the queue.
+ */
+void morse_stop(void)
+{
+  if (morse_phase == MORSE_MARK)
     key_handle_dashdot_end();
-    delay(state.key.dot_time);
+  morse_phase = MORSE_IDLE;
+  morse_queued = 0;
+  state.key.busy = 0;
+}
+
+/**
+ * Check whether a character or pause is being sent.
+ */
+byte morse_busy(void)
+{
+  return morse_phase != MORSE_IDLE;
+}
+
+/**
+ * Run the sender. Should be called on every tick from the keying task while
+ * morse_busy(). When a character has been sent, the next character queued by
+ * morse() is started.
+ */
+void morse_poll(void)
+{
+  if (morse_phase == MORSE_IDLE)
+    return;
+
+  if (morse_break_in && key_active()) {
+    morse_stop();
+    return;
   }
 
-  delay(state.key.dash_time);
+  if ((long) (tcount - morse_end) < 0)
+    return;
+
+  switch (morse_phase) {
+    case MORSE_MARK:
+      key_handle_dashdot_end();
+      morse_wait(MORSE_SPACE, state.key.dot_time);
+      break;
+    case MORSE_SPACE:
+      morse_next_element();
+      break;
+    case MORSE_END:
+      morse_phase = MORSE_IDLE;
+      state.key.busy = 0;
+      if (morse_queued) {
+        byte character = morse_queue[0];
+        for (byte i = 1; i < morse_queued; i++)
+          morse_queue[i - 1] = morse_queue[i];
+        morse_queued--;
+        morse_send(character, 0);
+      }
+      break;
+  }
 }
 
 // vim: tabstop=2 shiftwidth=2 expandtab:
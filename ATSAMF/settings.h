@@ -23,9 +23,15 @@
 
 #define SIDETONE_FREQ       600 /* Frequency of the sidetone, in Hz */
 
-#define MEMORY_LENGTH        64 /* Length of memories, including spacing */
+#ifndef HANG_TIME /* May be set by the build, e.g. for `make bench-qsk` */
+#define HANG_TIME           250 /* Semi-break-in hang time in ms; 0 for QSK */
+#endif
+
+#define MEMORY_LENGTH        64 /* Space per memory before the channels, see memory.h */
 #define MEMORY_EEPROM_START  16 /* Start of memory block in EEPROM */
 
+#define CHANNEL_COUNT         5 /* Number of frequency channel memories */
+
 #define BEACON_INTERVAL      15 /* Interval of TXs in number of dot-times */
 
 /* The tuning steps (rotated through with the encoder button) in mHz (max 8) */
@@ -59,4 +65,15 @@
 /* Obscure CW number abbrevations in DFE and more memories mode */
 #define OPT_OBSCURE_MORSE_ABBREVIATIONS
 
+/* Send 0 and 9 as T and N in serial numbers in memories */
+#define OPT_CUT_NUMBERS
+
+/* Reset and resume on lockups and errors (requires a bootloader that handles
+ * watchdog resets, such as Optiboot) */
+#define OPT_WATCHDOG
+
+/* Record inputs, TX and frequency changes in RAM, to be dumped over serial by
+ * holding the encoder button for 8s (for test/replay_avr.c) */
+//#define OPT_INPUT_TRACE
+
 // vim: tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,62 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef _H_TASKS
+#define _H_TASKS
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* The tasks, from highest to lowest priority */
+enum task
+#ifdef __cplusplus
+  : unsigned char
+#endif
+  {
+  TASK_KEYING,
+  TASK_RF,
+  TASK_INPUT,
+  TASK_DISPLAY,
+  TASK_EEPROM,
+  TASK_COUNT
+};
+
+struct task_stats {
+  unsigned long worst; /* longest run time in us */
+  unsigned char missed; /* number of missed deadlines (saturates at 255) */
+};
+
+extern struct task_stats task_stats[TASK_COUNT];
+
+void task_post(enum task);
+void task_post_in(enum task, unsigned int);
+void tasks_isr(void);
+byte tasks_run(void);
+void tasks_sleep(void);
+
+extern void task_handle_keying(void);
+extern void task_handle_rf(void);
+extern void task_handle_input(void);
+extern void task_handle_display(void);
+extern void task_handle_eeprom(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,180 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+/**
+ * A cooperative scheduler. Tasks are posted by events (mostly from the Timer1
+ * ISR, see tasks_isr()) and run to completion, the highest priority first.
+ * What a task does is defined by the task_handle_* functions. They must not
+ * block: a task that has to wait posts itself again with task_post_in().
+ */
+
+#include <avr/sleep.h>
+
+#include "tasks.h"
+
+#define TASK_BIT(task) (1 << (task))
+
+/* Maximum time from posting a task until it runs, in ms */
+static const unsigned int task_deadline[TASK_COUNT] = {
+  2,    /* TASK_KEYING */
+  5,    /* TASK_RF */
+  20,   /* TASK_INPUT */
+  128,  /* TASK_DISPLAY */
+  1000, /* TASK_EEPROM */
+};
+
+static void (*const task_handlers[TASK_COUNT])(void) = {
+  task_handle_keying,
+  task_handle_rf,
+  task_handle_input,
+  task_handle_display,
+  task_handle_eeprom,
+};
+
+static volatile byte task_events = 0;
+static unsigned int task_posted[TASK_COUNT];
+
+/* Remaining time until a task is posted by tasks_isr() (0 if not set) */
+static unsigned int task_timer[TASK_COUNT];
+
+struct task_stats task_stats[TASK_COUNT];
+
+/**
+ * Set the event bits of tasks. Must be called with interrupts disabled.
+ */
+static void post_events(byte events)
+{
+  byte new_events = events & ~task_events;
+  for (byte task = 0; task < TASK_COUNT; task++)
+    if (new_events & TASK_BIT(task))
+      task_posted[task] = tcount;
+  task_events |= events;
+}
+
+/**
+ * Post a task from outside an ISR, for instance when a task needs another
+ * task to run soon.
+ */
+void task_post(enum task task)
+{
+  noInterrupts();
+  post_events(TASK_BIT(task));
+  interrupts();
+}
+
+/**
+ * Post a task after some time. When the task already has a timer that expires
+ * earlier, that one is kept; the handler is then expected to post itself again
+ * when it still needs to.
+ *
+ * @param task the task.
+ * @param time the time in ms.
+ */
+void task_post_in(enum task task, unsigned int time)
+{
+  if (!time) {
+    task_post(task);
+    return;
+  }
+  noInterrupts();
+  if (!task_timer[task] || time < task_timer[task])
+    task_timer[task] = time;
+  interrupts();
+}
+
+/**
+ * Post tasks on timer and input events. Should be called from the Timer1 ISR,
+ * after key_isr() and buttons_isr().
+ * The keying task is posted on every tick while a character is being keyed or
+ * sent, since the keyer does its own timing. The input task is posted when an
+ * input has changed (see buttons_isr()).
+ */
+void tasks_isr(void)
+{
+  byte events = 0;
+
+  for (byte task = 0; task < TASK_COUNT; task++)
+    if (task_timer[task] && !--task_timer[task])
+      events |= TASK_BIT(task);
+
+  if (state.key.busy || state.state == S_MEM_SEND_TX)
+    events |= TASK_BIT(TASK_KEYING);
+  if (state.inputs.changed) {
+    state.inputs.changed = 0;
+    events |= TASK_BIT(TASK_INPUT);
+  }
+  if (state.key.hang_expired)
+    events |= TASK_BIT(TASK_RF);
+  if (!((byte) tcount & 0x7f))
+    events |= TASK_BIT(TASK_DISPLAY) | TASK_BIT(TASK_EEPROM);
+
+  post_events(events);
+}
+
+/**
+ * Run the pending task with the highest priority, and record its run time and
+ * whether it missed its deadline in task_stats.
+ *
+ * @return 0 if no task was pending, 1 otherwise.
+ */
+byte tasks_run(void)
+{
+  byte task;
+  unsigned int latency;
+  unsigned long start, time;
+
+  noInterrupts();
+  for (task = 0; task < TASK_COUNT; task++)
+    if (task_events & TASK_BIT(task))
+      break;
+  if (task == TASK_COUNT) {
+    interrupts();
+    return 0;
+  }
+  task_events &= ~TASK_BIT(task);
+  latency = (unsigned int) tcount - task_posted[task];
+  interrupts();
+
+  start = micros();
+  task_handlers[task]();
+  time = micros() - start;
+
+  if (time > task_stats[task].worst)
+    task_stats[task].worst = time;
+  if (latency > task_deadline[task] && task_stats[task].missed < 0xff)
+    task_stats[task].missed++;
+
+  return 1;
+}
+
+/**
+ * Sleep until the next interrupt, unless a task is pending. Interrupts are
+ * only enabled right before sleeping, so that an event posted in between is
+ * not missed.
+ */
+void tasks_sleep(void)
+{
+  noInterrupts();
+  if (task_events) {
+    interrupts();
+    return;
+  }
+  sleep_enable();
+  interrupts();
+  sleep_cpu();
+  sleep_disable();
+}
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,53 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef _H_TRACE
+#define _H_TRACE
+
+#define TRACE_LENGTH 256 /* Size of the ring buffer; must be a power of 2 */
+#define TRACE_BAUD 57600
+
+/* Every event in the trace starts with the number of ticks since the previous
+ * event, in groups of 7 bits (least significant first) of which all but the
+ * last have the high bit set. Then follows the type, which is one of the
+ * following, or the inputs (below 0x80): bits 0-4 are the buttons and encoder
+ * (as in struct inputs) and bits 5 and 6 the dot and dash paddle. A set bit
+ * means the input is active. */
+#define TRACE_TX_OFF 0x80
+#define TRACE_TX_ON  0x81
+#define TRACE_FREQ   0x82 /* followed by the frequency (4 bytes, little endian) */
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#ifdef OPT_INPUT_TRACE
+void trace_inputs(byte);
+void trace_tx(byte);
+void trace_freq(unsigned long);
+void trace_dump(void);
+#else
+# define trace_inputs(inputs) ((void) 0)
+# define trace_tx(on)         ((void) 0)
+# define trace_freq(freq)     ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,204 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+/**
+ * A recorder of input changes, TX and frequency changes, to reproduce problems
+ * from the field with test/replay_avr.c. The events are kept in a ring buffer
+ * in RAM; when it is full, the oldest events are dropped.
+ */
+
+#ifdef OPT_INPUT_TRACE
+
+#include "trace.h"
+
+#if TRACE_LENGTH & (TRACE_LENGTH - 1)
+# error "TRACE_LENGTH must be a power of 2"
+#endif
+
+#define TRACE_NEXT(i) (((i) + 1) & (TRACE_LENGTH - 1))
+#define TRACE_FREE() ((trace_tail - trace_head - 1) & (TRACE_LENGTH - 1))
+#define TRACE_MAX_EVENT 10 /* time (5 bytes), type and frequency */
+
+static byte trace_buffer[TRACE_LENGTH];
+static unsigned int trace_head = 0;
+static unsigned int trace_tail = 0;
+static unsigned long trace_tail_time; /* time of the oldest event */
+static unsigned long trace_last_time; /* time of the newest event */
+static byte trace_last_inputs = 0;
+static byte trace_paused = 0;
+static byte trace_wrapped = 0;
+
+/**
+ * Read the time of an event.
+ *
+ * @param i the index of the event; is moved to the type.
+ */
+static unsigned long trace_read_time(unsigned int *i)
+{
+  unsigned long time = 0;
+  byte shift = 0;
+  byte b;
+
+  do {
+    b = trace_buffer[*i];
+    *i = TRACE_NEXT(*i);
+    time |= (unsigned long) (b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+
+  return time;
+}
+
+/**
+ * Drop the oldest event.
+ */
+static void trace_drop(void)
+{
+  unsigned int i = trace_tail;
+
+  trace_read_time(&i);
+  if (trace_buffer[i] == TRACE_FREQ)
+    i = (i + 4) & (TRACE_LENGTH - 1);
+  trace_tail = TRACE_NEXT(i);
+  trace_wrapped = 1;
+
+  i = trace_tail;
+  if (i != trace_head)
+    trace_tail_time += trace_read_time(&i);
+}
+
+static void trace_put(byte b)
+{
+  trace_buffer[trace_head] = b;
+  trace_head = TRACE_NEXT(trace_head);
+}
+
+/**
+ * Add an event. Must be called with interrupts disabled.
+ */
+static void trace_add(byte type, const byte *data, byte length)
+{
+  unsigned long delta;
+
+  if (trace_paused)
+    return;
+
+  while (TRACE_FREE() < TRACE_MAX_EVENT)
+    trace_drop();
+
+  if (trace_head == trace_tail) {
+    trace_tail_time = tcount;
+    delta = 0;
+  } else {
+    delta = tcount - trace_last_time;
+  }
+  trace_last_time = tcount;
+
+  for (; delta >= 0x80; delta >>= 7)
+    trace_put(delta | 0x80);
+  trace_put(delta);
+  trace_put(type);
+  while (length--)
+    trace_put(*data++);
+}
+
+/**
+ * Record the inputs if they have changed. Should be called from buttons_isr().
+ */
+void trace_inputs(byte inputs)
+{
+  if (inputs == trace_last_inputs)
+    return;
+  trace_last_inputs = inputs;
+  trace_add(inputs, NULL, 0);
+}
+
+/**
+ * Record that TX was switched on or off.
+ */
+void trace_tx(byte on)
+{
+  noInterrupts();
+  trace_add(on ? TRACE_TX_ON : TRACE_TX_OFF, NULL, 0);
+  interrupts();
+}
+
+/**
+ * Record a change of the operating frequency.
+ */
+void trace_freq(unsigned long freq)
+{
+  noInterrupts();
+  trace_add(TRACE_FREQ, (const byte*) &freq, 4);
+  interrupts();
+}
+
+static void dump_hex(byte b)
+{
+  Serial.print(b >> 4, HEX);
+  Serial.print(b & 0xf, HEX);
+}
+
+/**
+ * Write the trace and the EEPROM to the serial port, in the format read by
+ * test/replay_avr.c. The serial port shares its pins with the encoder, so
+ * nothing is recorded during the dump and the encoder does not work.
+ */
+void trace_dump(void)
+{
+  unsigned int i, n;
+
+  trace_paused = 1;
+  Serial.begin(TRACE_BAUD);
+
+  Serial.println(F("# ATSAMF input trace"));
+  Serial.print(F("T "));
+  Serial.println(trace_tail_time);
+  Serial.print(F("W "));
+  Serial.println(trace_wrapped);
+
+  for (i = trace_tail, n = 0; i != trace_head; i = TRACE_NEXT(i), n++) {
+    if (n % 32 == 0)
+      Serial.print(F("D "));
+    dump_hex(trace_buffer[i]);
+    if (n % 32 == 31 || TRACE_NEXT(i) == trace_head) {
+      Serial.println();
+      watchdog_feed();
+    }
+  }
+
+  for (i = 0; i <= E2END; i++) {
+    if (i % 32 == 0)
+      Serial.print(F("E "));
+    dump_hex(EEPROM.read(i));
+    if (i % 32 == 31) {
+      Serial.println();
+      watchdog_feed();
+    }
+  }
+
+  Serial.flush();
+  Serial.end();
+
+  noInterrupts();
+  state.inputs.encoder_value = 0;
+  state.inputs.encoder_last_clock = state.inputs.encoder_clock;
+  interrupts();
+  trace_paused = 0;
+}
+
+#endif
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
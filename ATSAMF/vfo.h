@@ -0,0 +1,52 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef _H_VFO
+#define _H_VFO
+
+#include "ATSAMF.h"
+
+/* The Si5351 registers with the PLL and multisynth parameters of CLK0 and
+ * CLK1. These are the only registers that change with the frequency. */
+#define SYNTH_IMAGE_START  26
+#define SYNTH_IMAGE_LENGTH 32
+
+/* Channel memories in EEPROM: frequency (4 bytes), tag (1 byte; 0xff when the
+ * image is not valid) and the register image. */
+#define CHANNEL_SIZE         (5 + SYNTH_IMAGE_LENGTH)
+#define CHANNEL_EEPROM_START (MEMORY_EEPROM_START + 10 * MEMORY_LENGTH)
+#define CHANNEL_EEPROM_END   (CHANNEL_EEPROM_START + CHANNEL_COUNT * CHANNEL_SIZE)
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+void vfo_reset(void);
+void vfo_invalidate(void);
+void vfo_swap(void);
+void vfo_toggle_split(void);
+
+unsigned long channel_freq(byte);
+byte channel_recall(byte);
+void channel_store(byte);
+void channel_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
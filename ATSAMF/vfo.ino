@@ -0,0 +1,289 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#include "vfo.h"
+
+#if CHANNEL_EEPROM_END > E2END + 1
+# error "The channel memories do not fit in EEPROM; decrease CHANNEL_COUNT"
+#endif
+
+/* The Wire buffer holds 32 bytes including the register address, so the
+ * image is written in two bursts. */
+#define SYNTH_BURST_LENGTH (SYNTH_IMAGE_LENGTH / 2)
+
+/**
+ * For both VFOs, the Si5351 register image of the RX and TX clocks when that
+ * VFO is active. The image of the active VFO is read back from the Si5351 when
+ * it is needed, so that tuning does not become slower. The bits of
+ * vfo_image_valid are set for images that are up to date.
+ */
+static byte vfo_image[2][SYNTH_IMAGE_LENGTH];
+static byte vfo_image_valid = 0;
+
+#define VFO_BIT(vfo) (1 << (vfo))
+
+/**
+ * A channel memory that has been stored but not yet written to EEPROM. The
+ * bytes are written by channel_flush() in the EEPROM task, because writing the
+ * whole channel at once would block the input task for over 100ms.
+ * channel_page_nr is 0xff when nothing is pending.
+ */
+static byte channel_page[CHANNEL_SIZE];
+static byte channel_page_nr = 0xff;
+static byte channel_written;
+static byte channel_length;
+
+/**
+ * Write a register image to the Si5351.
+ */
+static void synth_write_image(const byte *image)
+{
+  for (byte i = 0; i < SYNTH_IMAGE_LENGTH; i += SYNTH_BURST_LENGTH) {
+    Wire.beginTransmission(0x60);
+    Wire.write(SYNTH_IMAGE_START + i);
+    Wire.write(&image[i], SYNTH_BURST_LENGTH);
+    Wire.endTransmission();
+  }
+}
+
+/**
+ * Read the current register image from the Si5351.
+ */
+static void synth_read_image(byte *image)
+{
+  Wire.beginTransmission(0x60);
+  Wire.write(SYNTH_IMAGE_START);
+  Wire.endTransmission();
+  Wire.requestFrom((uint8_t) 0x60, (uint8_t) SYNTH_IMAGE_LENGTH);
+  for (byte i = 0; i < SYNTH_IMAGE_LENGTH; i++)
+    image[i] = Wire.read();
+}
+
+/**
+ * Make sure the image of the active VFO is up to date. This is only correct
+ * when the Si5351 is set to the frequencies of the active VFO, i.e., not with
+ * RIT or during calibration.
+ */
+static byte *active_image(void)
+{
+  if (!(vfo_image_valid & VFO_BIT(state.vfo))) {
+    synth_read_image(vfo_image[state.vfo]);
+    vfo_image_valid |= VFO_BIT(state.vfo);
+  }
+  return vfo_image[state.vfo];
+}
+
+/**
+ * A tag for the calibration data the register images were computed with. The
+ * tag is never 0xff, which marks invalid images in EEPROM.
+ */
+static byte synth_tag(void)
+{
+  unsigned long data[] = {(unsigned long) cal_value, IFfreq};
+  byte *bytes = (byte*) data;
+  byte tag = 0xa5;
+  for (byte i = 0; i < sizeof(data); i++)
+    tag = (tag << 1 | tag >> 7) ^ bytes[i];
+  return tag == 0xff ? 0x00 : tag;
+}
+
+/**
+ * Turn RIT off, returning to the TX frequency.
+ */
+static void vfo_disable_rit(void)
+{
+  if (!state.rit)
+    return;
+  state.rit = 0;
+  state.op_freq = state.rit_tx_freq;
+  state.tuning_step = 0;
+  invalidate_frequencies();
+}
+
+/**
+ * Reset both VFOs to the operating frequency and disable split. This should be
+ * called after a band change or calibration.
+ */
+void vfo_reset(void)
+{
+  state.vfo_other_freq = state.op_freq;
+  state.split = 0;
+  vfo_image_valid = 0;
+}
+
+/**
+ * Mark the register images that depend on the frequency of the active VFO as
+ * out of date. This is done by invalidate_frequencies(), so that any change to
+ * the frequencies is covered.
+ */
+void vfo_invalidate(void)
+{
+  vfo_image_valid &= ~VFO_BIT(state.vfo);
+  if (state.split)
+    vfo_image_valid &= ~VFO_BIT(!state.vfo);
+}
+
+/**
+ * Swap VFO A and B. When the register image of the other VFO is up to date,
+ * it is written to the Si5351 directly, without computing the synthesizer
+ * parameters. RIT is disabled.
+ */
+void vfo_swap(void)
+{
+  unsigned long freq;
+
+  vfo_disable_rit();
+  active_image();
+
+  freq = state.op_freq;
+  state.op_freq = state.vfo_other_freq;
+  state.vfo_other_freq = freq;
+  state.vfo = !state.vfo;
+
+  if (vfo_image_valid & VFO_BIT(state.vfo)) {
+    synth_write_image(vfo_image[state.vfo]);
+    trace_freq(state.op_freq);
+  } else {
+    invalidate_frequencies();
+  }
+}
+
+/**
+ * Toggle split operation, i.e., receiving on the active VFO and transmitting
+ * on the other. RIT is disabled.
+ */
+void vfo_toggle_split(void)
+{
+  vfo_disable_rit();
+  state.split = !state.split;
+  invalidate_frequencies();
+  /* the image of the other VFO has the wrong TX frequency now */
+  vfo_image_valid = 0;
+}
+
+/**
+ * Read a byte of a channel memory, from the page buffer if the channel has not
+ * been written yet.
+ */
+static byte channel_read(byte nr, byte offset)
+{
+  if (nr == channel_page_nr)
+    return channel_page[offset];
+  return EEPROM.read(CHANNEL_EEPROM_START + nr * CHANNEL_SIZE + offset);
+}
+
+/**
+ * Get the frequency stored in a channel memory, or 0xffffffff for an empty
+ * channel.
+ */
+unsigned long channel_freq(byte nr)
+{
+  unsigned long freq;
+  freq =               channel_read(nr, 3);
+  freq = (freq << 8) + channel_read(nr, 2);
+  freq = (freq << 8) + channel_read(nr, 1);
+  freq = (freq << 8) + channel_read(nr, 0);
+  return freq;
+}
+
+/**
+ * Recall a channel memory to the active VFO. Outside split operation, the
+ * register image stored with the channel is written to the Si5351 directly,
+ * as long as the calibration has not changed since it was stored.
+ *
+ * @return 0 if the channel is empty or not in the current band, 1 otherwise.
+ */
+byte channel_recall(byte nr)
+{
+  unsigned long freq = channel_freq(nr);
+
+  if (freq == 0xfffffffful || band_fix_freq(state.band, freq, 0) != freq)
+    return 0;
+
+  vfo_disable_rit();
+  state.op_freq = freq;
+
+  if (!state.split && channel_read(nr, 4) == synth_tag()) {
+    for (byte i = 0; i < SYNTH_IMAGE_LENGTH; i++)
+      vfo_image[state.vfo][i] = channel_read(nr, 5 + i);
+    synth_write_image(vfo_image[state.vfo]);
+    vfo_image_valid |= VFO_BIT(state.vfo);
+    trace_freq(state.op_freq);
+  } else {
+    invalidate_frequencies();
+  }
+
+  return 1;
+}
+
+/**
+ * Write the next byte of the pending channel memory to EEPROM.
+ */
+static void channel_write_next(void)
+{
+  EEPROM.write(CHANNEL_EEPROM_START + channel_page_nr * CHANNEL_SIZE +
+      channel_written, channel_page[channel_written]);
+  if (++channel_written == channel_length)
+    channel_page_nr = 0xff;
+}
+
+/**
+ * Store the frequency of the active VFO in a channel memory. With RIT, the TX
+ * frequency is stored. The register image is only stored outside split and
+ * RIT operation, since otherwise the Si5351 is not set to the frequency of the
+ * channel. The channel is written to EEPROM later by channel_flush(); a
+ * channel that is still pending is written first.
+ */
+void channel_store(byte nr)
+{
+  unsigned long freq = state.rit ? state.rit_tx_freq : state.op_freq;
+  byte simplex = !state.rit && !state.split;
+
+  while (channel_page_nr != 0xff)
+    channel_write_next();
+
+  channel_page[0] = freq;
+  channel_page[1] = freq >> 8;
+  channel_page[2] = freq >> 16;
+  channel_page[3] = freq >> 24;
+  channel_page[4] = simplex ? synth_tag() : 0xff;
+  channel_length = 5;
+
+  if (simplex) {
+    byte *image = active_image();
+    for (byte i = 0; i < SYNTH_IMAGE_LENGTH; i++)
+      channel_page[channel_length++] = image[i];
+  }
+
+  channel_written = 0;
+  channel_page_nr = nr;
+  task_post(TASK_EEPROM);
+}
+
+/**
+ * Write the pending channel memory to EEPROM, one byte at a time while the key
+ * is up, like memory_record_flush(). This is called from the EEPROM task.
+ */
+void channel_flush(void)
+{
+  if (channel_page_nr == 0xff || key_active())
+    return;
+  if (eeprom_is_ready())
+    channel_write_next();
+  if (channel_page_nr != 0xff)
+    task_post_in(TASK_EEPROM, MEMORY_WRITE_TIME);
+}
+
+// vim: tabstop=2 shiftwidth=2 expandtab:
@@ -19,7 +19,12 @@ module Main where
 
 import Control.Arrow
 import Control.Monad
+import Data.List (dropWhileEnd, intercalate, intersperse)
+import Data.Word
 import Foreign.C.String
+import Foreign.C.Types
+import Foreign.Marshal.Array
+import Foreign.Ptr
 import System.Exit
 import Test.QuickCheck hiding (Result)
 import Test.QuickCheck.Monadic
@@ -38,12 +43,25 @@ import Test.QuickCheck.Random
   and dashes are sent alternatingly, starting with whichever lever was squeezed
   first and until one of the levers is released (after which we return to
   normal mode).
+
+  It also tests the straight key decoder in key.ino, which classifies the
+  timing of a straight key into dots, dashes, character and word breaks.
+
+  Finally, it tests the message memories in memory.ino (with test_memory.c),
+  in particular that memories stored before they were chained in blocks are
+  still read correctly.
 -}
 
 main :: IO ()
 main = do
   result <- quickCheckWithResult args testAgainstSpecification
   unless (isSuccess result) exitFailure
+  straightResult <- quickCheckWithResult args testStraightKeyDecoder
+  unless (isSuccess straightResult) exitFailure
+  legacyResult <- quickCheckWithResult args testLegacyMemories
+  unless (isSuccess legacyResult) exitFailure
+  recordResult <- quickCheckWithResult args testRecordMemory
+  unless (isSuccess recordResult) exitFailure
   where
     args = stdArgs
       { replay = Just (mkQCGen 0, 0), -- Fix the random seed for reproducible counter-examples
@@ -159,3 +177,144 @@ iambicKey input =
   run_test >=> peekCString >>^ fmap (unwords . words)
 
 foreign import ccall "test_key.h run_test" run_test :: CString -> IO CString
+
+-- |A morse character as a non-empty sequence of up to six dots ('.') and
+-- dashes ('-').
+newtype MorseCharacter = MorseCharacter { getMorseCharacter :: String }
+
+instance Show MorseCharacter where show = getMorseCharacter
+
+instance Arbitrary MorseCharacter where
+  arbitrary = do
+    n <- choose (1, 6)
+    MorseCharacter <$> vectorOf n (elements ".-")
+
+-- |Timing of a text keyed on a straight key: the operator's dot time and the
+-- dot time the decoder starts with (in ms), the text (a list of words), and
+-- the durations of the alternating marks and spaces (in ms).
+data StraightKeyInput = StraightKeyInput
+  { operatorDotTime :: Int,
+    decoderDotTime :: Int,
+    straightKeyText :: [[MorseCharacter]],
+    straightKeyTrace :: [Int]
+  }
+  deriving Show
+
+-- |The 'Arbitrary' instance generates operators from 5 to 30 WPM. The decoder
+-- starts with a dot time that is up to 15% off. Each mark and space has a
+-- jitter of up to 15%.
+instance Arbitrary StraightKeyInput where
+  arbitrary = do
+    dot <- choose (40, 240)
+    decoderDot <- min 240 <$> choose (dot * 85 `div` 100, dot * 115 `div` 100)
+    text <- resize 5 (listOf1 (listOf1 arbitrary))
+    trace <- mapM (jitter dot) (idealTrace text)
+    return (StraightKeyInput dot decoderDot text trace)
+    where
+      jitter dot units = do
+        percentage <- choose (85, 115)
+        return (units * dot * percentage `div` 100)
+
+-- |The durations of marks and spaces of a text in dot times.
+idealTrace :: [[MorseCharacter]] -> [Int]
+idealTrace = intercalate [7] . map (intercalate [3] . map character)
+  where
+    character = intersperse 1 . map element . getMorseCharacter
+    element '.' = 1
+    element _ = 3
+
+-- |Checks that the straight key decoder recovers the keyed text. Every
+-- character is followed by a space; every word by "/ ".
+testStraightKeyDecoder :: StraightKeyInput -> Property
+testStraightKeyDecoder input = monadicIO $ do
+  output <- run (straightKey input)
+  stop $ output === expected :: PropertyM IO ()
+  where
+    expected = concatMap (\word -> concatMap ((++ " ") . show) word ++ "/ ") (straightKeyText input)
+
+-- |Run a straight key test case against the actual C implementation.
+straightKey :: StraightKeyInput -> IO String
+straightKey input =
+  withArrayLen (map fromIntegral (straightKeyTrace input)) $ \n trace ->
+    run_straight_test (fromIntegral (decoderDotTime input)) trace (fromIntegral n)
+      >>= peekCString
+
+foreign import ccall "test_key.h run_straight_test" run_straight_test :: CUChar -> Ptr CUInt -> CInt -> IO CString
+
+-- |The length of the slots in which the memories were stored before they were
+-- chained in blocks (MEMORY_LENGTH).
+slotLength :: Int
+slotLength = fromIntegral memory_slot_length
+
+foreign import ccall "test_memory.h memory_slot_length" memory_slot_length :: CInt
+
+-- |A character in a memory: a word break (0) or a morse character of up to six
+-- elements, but not a token (see memory.h).
+memoryCharacter :: Gen Word8
+memoryCharacter = frequency [(1, pure 0), (9, elements characters)]
+  where
+    characters = [c | c <- [2 .. 0x7f], c `notElem` [0x13, 0x1e, 0x1f]]
+
+-- |The characters that are transmitted for a memory: trailing word breaks are
+-- skipped.
+transmitted :: [Word8] -> [Word8]
+transmitted = dropWhileEnd (== 0)
+
+-- |The ten memories of an EEPROM in the legacy layout: memory n is stored in
+-- slot n. It ends with 0xff, unless it fills the slot. The 'Arbitrary' instance
+-- generates many full memories, which have no end marker.
+newtype LegacyMemories = LegacyMemories { getLegacyMemories :: [[Word8]] }
+  deriving Show
+
+instance Arbitrary LegacyMemories where
+  arbitrary = LegacyMemories <$> vectorOf 10 memory
+    where
+      memory = do
+        n <- frequency [(1, pure slotLength), (3, choose (0, slotLength))]
+        vectorOf n memoryCharacter
+
+-- |Checks that the memories in the legacy layout are read as they were stored.
+testLegacyMemories :: LegacyMemories -> Property
+testLegacyMemories memories = monadicIO $ do
+  output <- run (loadLegacyMemories memories >> mapM readMemory [0..9])
+  stop $ output === map transmitted (getLegacyMemories memories) :: PropertyM IO ()
+
+-- |A memory recorded over the legacy layout: the memories that were there, the
+-- number of the new memory, and its characters.
+data RecordInput = RecordInput LegacyMemories Word8 [Word8]
+  deriving Show
+
+instance Arbitrary RecordInput where
+  arbitrary = RecordInput <$> arbitrary <*> choose (0, 9) <*> resize 255 (listOf memoryCharacter)
+
+-- |Checks that a recorded memory is read as it was recorded, as far as there
+-- was space for it, and that the other memories are kept.
+testRecordMemory :: RecordInput -> Property
+testRecordMemory (RecordInput memories nr characters) = monadicIO $ do
+  (recorded, output) <- run $ do
+    loadLegacyMemories memories
+    recorded <- withArrayLen characters $ \n ptr ->
+      record_memory (fromIntegral nr) ptr (fromIntegral n)
+    output <- mapM readMemory [0..9]
+    return (fromIntegral recorded, output)
+  stop $ output === expected recorded :: PropertyM IO ()
+  where
+    expected recorded =
+      [ transmitted (if i == nr then take recorded characters else memory)
+      | (i, memory) <- zip [0..] (getLegacyMemories memories)
+      ]
+
+-- |Store memories in the legacy layout in the EEPROM of the C implementation.
+loadLegacyMemories :: LegacyMemories -> IO ()
+loadLegacyMemories memories =
+  withArray (concatMap slot (getLegacyMemories memories)) load_legacy_memories
+  where
+    slot memory = take slotLength (memory ++ repeat 0xff)
+
+-- |Read a memory from the C implementation, as it would be transmitted.
+readMemory :: Word8 -> IO [Word8]
+readMemory nr = read_memory (fromIntegral nr) >>= peekArray0 0xff
+
+foreign import ccall "test_memory.h load_legacy_memories" load_legacy_memories :: Ptr Word8 -> IO ()
+foreign import ccall "test_memory.h record_memory" record_memory :: CUChar -> Ptr Word8 -> CInt -> IO CInt
+foreign import ccall "test_memory.h read_memory" read_memory :: CUChar -> IO (Ptr Word8)
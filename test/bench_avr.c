@@ -0,0 +1,491 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+/**
+ * Cycle-accurate benchmark of the firmware in simavr.
+ *
+ * The real firmware (an ELF built with avr-gcc) is run on a simulated
+ * ATmega328P (see sim.c). Scenarios of button and paddle input are replayed,
+ * and for a number of functions the number of cycles per call is measured. For
+ * the Timer1 ISR, the interrupt latency is measured as well.
+ *
+ * Usage: bench_avr [-w] FIRMWARE.elf SYMBOLS BASELINE SCENARIO...
+ *
+ * SYMBOLS is the output of avr-nm -C on the firmware. BASELINE contains lines
+ * of the form `NAME MAX_CYCLES`. Without -w, the run fails when the maximum
+ * for a function exceeds the baseline by more than TOLERANCE percent, or when
+ * a function that was called has no baseline. With -w, the baseline is
+ * overwritten with the results of this run.
+ *
+ * The number of I2C transactions from the first call to loop() is counted per
+ * scenario, and compared to the baseline entry `i2c:SCENARIO` in the same way.
+ *
+ * The worst-case run time and number of missed deadlines that the firmware
+ * records for its tasks (see tasks.ino) are read from RAM and reported too.
+ *
+ * A scenario consists of lines of the form `TIME INPUT VALUE`, where TIME is in
+ * ms after the first call to loop(), INPUT is one of the names in inputs[]
+ * in sim.c, and VALUE is 1 for pressed (the pin is pulled low) or 0 for
+ * released. Lines starting with # are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define TOLERANCE 10 /* Allowed regression, in percent */
+#define TAIL_MS 2000 /* Time to run after the last event of a scenario */
+#define MAX_EVENTS 1024
+#define MAX_SCENARIOS 16
+#define MAX_DEPTH 16
+
+#define TIFR1 (0x16 + 0x20)
+#define OCF1A 1
+#define TIMER1_COMPA_VECTOR "__vector_11"
+
+/* The functions that are measured */
+struct function {
+	const char *name;
+	const char *symbol;
+	avr_flashaddr_t address;
+	unsigned long calls;
+	avr_cycle_count_t total;
+	avr_cycle_count_t max;
+	avr_cycle_count_t baseline;
+};
+
+static struct function functions[] = {
+	{"TIMER1_COMPA_vect",      TIMER1_COMPA_VECTOR},
+	{"key_isr",                "key_isr"},
+	{"buttons_isr",            "buttons_isr"},
+	{"display_isr",            "display_isr"},
+	{"invalidate_display",     "invalidate_display"},
+	{"invalidate_frequencies", "invalidate_frequencies"},
+	{"enable_rx_tx",           "enable_rx_tx"},
+};
+
+#define FUNCTION_COUNT (sizeof(functions) / sizeof(functions[0]))
+#define TIMER1_ISR (&functions[0])
+
+/* The tasks of the firmware, in the order of enum task (see tasks.h) */
+static const char *tasks[] = {
+	"task_keying",
+	"task_rf",
+	"task_input",
+	"task_display",
+	"task_eeprom",
+};
+
+#define TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+#define TASK_STATS_SIZE 5 /* sizeof(struct task_stats) on the AVR */
+
+static uint32_t task_stats_address;
+static unsigned long task_worst[TASK_COUNT], task_missed[TASK_COUNT];
+
+/* The scenarios that are run */
+struct scenario {
+	char name[64]; /* the file name without directory and extension */
+	unsigned long transactions;
+	unsigned long baseline;
+};
+
+static struct scenario scenarios[MAX_SCENARIOS];
+static unsigned int scenario_count;
+
+struct event {
+	unsigned long time;
+	const struct input *input;
+	int value;
+};
+
+/* A call that is currently being measured */
+struct frame {
+	struct function *function;
+	uint16_t sp;
+	avr_cycle_count_t start;
+	avr_cycle_count_t interrupted; /* cycles spent in nested ISRs */
+};
+
+static struct frame stack[MAX_DEPTH];
+static int depth;
+
+static avr_cycle_count_t latency_total, latency_max, latency_baseline;
+static unsigned long latency_count;
+static avr_cycle_count_t compare_match;
+
+static avr_flashaddr_t loop_address;
+static avr_cycle_count_t loop_start;
+static unsigned long loop_transactions;
+
+/**
+ * Preload the EEPROM with settings, so that the firmware does not start in
+ * the calibration routine (see the EEPROM_* addresses in ATSAMF.h).
+ */
+static void load_eeprom(void)
+{
+	static uint8_t settings[] = {
+		0xc0, 0x63, 0x4b, 0x1d, /* IF frequency: 491480000 */
+		0xff, 0xff,
+		0x04,                   /* band */
+		20,                     /* CW speed */
+		0x98, 0x3a, 0x00, 0x00, /* calibration: 15000 */
+	};
+
+	sim_load_eeprom(settings, sizeof(settings));
+}
+
+static void apply_event(const struct event *event)
+{
+	sim_set_input(event->input, event->value);
+}
+
+static uint16_t sp(void)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+/**
+ * Called before every instruction: check for returns from and calls to the
+ * measured functions, and for the Timer1 compare match flag.
+ */
+static void trace(void)
+{
+	uint16_t current_sp = sp();
+
+	while (depth > 0 && current_sp > stack[depth-1].sp) {
+		struct frame *frame = &stack[--depth];
+		avr_cycle_count_t cycles = avr->cycle - frame->start;
+
+		if (frame->function != TIMER1_ISR)
+			cycles -= frame->interrupted;
+		if (depth > 0)
+			stack[depth-1].interrupted +=
+				frame->function == TIMER1_ISR ? cycles : frame->interrupted;
+
+		frame->function->calls++;
+		frame->function->total += cycles;
+		if (cycles > frame->function->max)
+			frame->function->max = cycles;
+	}
+
+	if (avr->data[TIFR1] & (1 << OCF1A)) {
+		if (!compare_match)
+			compare_match = avr->cycle;
+	}
+
+	if (avr->pc == loop_address && !loop_start) {
+		loop_start = avr->cycle;
+		loop_transactions = twi_transactions;
+	}
+
+	for (unsigned i = 0; i < FUNCTION_COUNT; i++) {
+		if (avr->pc != functions[i].address || !functions[i].address)
+			continue;
+
+		if (&functions[i] == TIMER1_ISR && compare_match) {
+			avr_cycle_count_t latency = avr->cycle - compare_match;
+			latency_total += latency;
+			latency_count++;
+			if (latency > latency_max)
+				latency_max = latency;
+			compare_match = 0;
+		}
+
+		if (depth < MAX_DEPTH) {
+			stack[depth].function = &functions[i];
+			stack[depth].sp = current_sp;
+			stack[depth].start = avr->cycle;
+			stack[depth].interrupted = 0;
+			depth++;
+		}
+	}
+}
+
+static int read_scenario(const char *path, struct event *events)
+{
+	FILE *f = fopen(path, "r");
+	char line[128], name[32];
+	int count = 0;
+
+	if (!f) {
+		perror(path);
+		exit(-1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct event *event = &events[count];
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (count == MAX_EVENTS ||
+				sscanf(line, "%lu %31s %d", &event->time, name, &event->value) != 3 ||
+				!(event->input = sim_find_input(name))) {
+			fprintf(stderr, "%s: cannot parse: %s", path, line);
+			exit(-1);
+		}
+		count++;
+	}
+
+	fclose(f);
+	return count;
+}
+
+static void read_symbols(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[256], type, name[200];
+	unsigned long address;
+
+	if (!f) {
+		perror(path);
+		exit(-1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx %c %199[^(\n]", &address, &type, name) != 3)
+			continue;
+		if (type != 'T' && type != 't')
+			continue;
+		if (!strcmp(name, "loop"))
+			loop_address = address;
+		for (unsigned i = 0; i < FUNCTION_COUNT; i++)
+			if (!strcmp(name, functions[i].symbol))
+				functions[i].address = address;
+	}
+
+	fclose(f);
+
+	if (!loop_address) {
+		fprintf(stderr, "%s: loop not found\n", path);
+		exit(-1);
+	}
+	for (unsigned i = 0; i < FUNCTION_COUNT; i++)
+		if (!functions[i].address)
+			fprintf(stderr, "warning: %s not found (inlined?)\n", functions[i].name);
+
+	task_stats_address = sim_data_symbol(path, "task_stats");
+	if (!task_stats_address)
+		fprintf(stderr, "warning: task_stats not found\n");
+}
+
+/**
+ * Read the task statistics from the RAM of the firmware (little endian).
+ */
+static void read_task_stats(void)
+{
+	if (!task_stats_address)
+		return;
+
+	for (unsigned i = 0; i < TASK_COUNT; i++) {
+		unsigned long stats = task_stats_address + i * TASK_STATS_SIZE;
+		unsigned long worst = sim_read_ram(stats, 4);
+		if (worst > task_worst[i])
+			task_worst[i] = worst;
+		task_missed[i] += sim_read_ram(stats + 4, 1);
+	}
+}
+
+static void read_baseline(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128], name[64];
+	unsigned long long cycles;
+
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%63s %llu", name, &cycles) != 2)
+			continue;
+		if (!strcmp(name, "interrupt_latency"))
+			latency_baseline = cycles;
+		for (unsigned i = 0; i < scenario_count; i++)
+			if (!strncmp(name, "i2c:", 4) && !strcmp(name + 4, scenarios[i].name))
+				scenarios[i].baseline = cycles;
+		for (unsigned i = 0; i < FUNCTION_COUNT; i++)
+			if (!strcmp(name, functions[i].name))
+				functions[i].baseline = cycles;
+	}
+
+	fclose(f);
+}
+
+static void write_baseline(const char *path)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		perror(path);
+		exit(-1);
+	}
+
+	fprintf(f, "# Maximum number of cycles per call and I2C transactions per scenario,\n"
+			"# written by bench_avr -w (see the bench targets in the Makefile)\n");
+	for (unsigned i = 0; i < FUNCTION_COUNT; i++)
+		if (functions[i].calls)
+			fprintf(f, "%s %llu\n", functions[i].name,
+					(unsigned long long) functions[i].max);
+	fprintf(f, "interrupt_latency %llu\n", (unsigned long long) latency_max);
+	for (unsigned i = 0; i < scenario_count; i++)
+		fprintf(f, "i2c:%s %lu\n", scenarios[i].name, scenarios[i].transactions);
+
+	fclose(f);
+}
+
+/**
+ * Compare a result to the baseline, and print why it fails if it does.
+ *
+ * @return 1 if the result is missing from the baseline or exceeds it by more
+ *   than TOLERANCE percent, 0 otherwise.
+ */
+static int check_baseline(avr_cycle_count_t result, avr_cycle_count_t baseline)
+{
+	if (!baseline) {
+		printf("  NO BASELINE");
+		return 1;
+	}
+	if (result * 100 > baseline * (100 + TOLERANCE)) {
+		printf("  REGRESSION");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Add a scenario to scenarios[], named after its file.
+ */
+static void add_scenario(const char *path)
+{
+	const char *name = strrchr(path, '/');
+	struct scenario *scenario = &scenarios[scenario_count++];
+
+	if (scenario_count > MAX_SCENARIOS) {
+		fprintf(stderr, "too many scenarios\n");
+		exit(-1);
+	}
+
+	snprintf(scenario->name, sizeof(scenario->name), "%s", name ? name + 1 : path);
+	scenario->name[strcspn(scenario->name, ".")] = '\0';
+}
+
+static void run_scenario(const char *elf, const char *path, struct scenario *scenario)
+{
+	static struct event events[MAX_EVENTS];
+	int count = read_scenario(path, events);
+	int next = 0;
+
+	sim_start(elf);
+	load_eeprom();
+
+	depth = 0;
+	loop_start = 0;
+	compare_match = 0;
+
+	unsigned long end = (count ? events[count-1].time : 0) + TAIL_MS;
+
+	while (1) {
+		int state = avr->state;
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "%s: firmware stopped at %#x\n", path, avr->pc);
+			exit(-1);
+		}
+
+		trace();
+
+		if (loop_start) {
+			unsigned long now = (avr->cycle - loop_start) / CYCLES_PER_MS;
+			while (next < count && events[next].time <= now)
+				apply_event(&events[next++]);
+			if (now >= end)
+				break;
+		}
+
+		avr_run(avr);
+	}
+
+	scenario->transactions = twi_transactions - loop_transactions;
+	read_task_stats();
+	avr_terminate(avr);
+}
+
+int main(int argc, char **argv)
+{
+	int write = 0;
+	int failed = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-w")) {
+		write = 1;
+		argv++;
+		argc--;
+	}
+
+	if (argc < 5) {
+		fprintf(stderr, "Usage: %s [-w] FIRMWARE.elf SYMBOLS BASELINE SCENARIO...\n", argv[0]);
+		return -1;
+	}
+
+	read_symbols(argv[2]);
+	for (int i = 4; i < argc; i++)
+		add_scenario(argv[i]);
+	read_baseline(argv[3]);
+
+	for (int i = 4; i < argc; i++)
+		run_scenario(argv[1], argv[i], &scenarios[i - 4]);
+
+	printf("%-24s %8s %8s %8s %8s\n", "function", "calls", "mean", "max", "baseline");
+	for (unsigned i = 0; i < FUNCTION_COUNT; i++) {
+		struct function *f = &functions[i];
+		if (!f->calls)
+			continue;
+
+		printf("%-24s %8lu %8llu %8llu %8llu", f->name, f->calls,
+				(unsigned long long) (f->total / f->calls),
+				(unsigned long long) f->max,
+				(unsigned long long) f->baseline);
+		if (!write)
+			failed |= check_baseline(f->max, f->baseline);
+		printf("\n");
+	}
+	if (latency_count) {
+		printf("%-24s %8lu %8llu %8llu %8llu", "interrupt_latency", latency_count,
+				(unsigned long long) (latency_total / latency_count),
+				(unsigned long long) latency_max,
+				(unsigned long long) latency_baseline);
+		if (!write)
+			failed |= check_baseline(latency_max, latency_baseline);
+		printf("\n");
+	}
+
+	printf("\n%-24s %8s %8s\n", "i2c_transactions", "count", "baseline");
+	for (unsigned i = 0; i < scenario_count; i++) {
+		printf("%-24s %8lu %8lu", scenarios[i].name, scenarios[i].transactions,
+				scenarios[i].baseline);
+		if (!write)
+			failed |= check_baseline(scenarios[i].transactions, scenarios[i].baseline);
+		printf("\n");
+	}
+
+	if (task_stats_address) {
+		printf("\n%-24s %8s %8s\n", "task", "worst_us", "missed");
+		for (unsigned i = 0; i < TASK_COUNT; i++)
+			printf("%-24s %8lu %8lu\n", tasks[i], task_worst[i], task_missed[i]);
+	}
+
+	if (write)
+		write_baseline(argv[3]);
+
+	return failed;
+}
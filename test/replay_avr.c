@@ -0,0 +1,404 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+/**
+ * Replay of an input trace recorded on the rig (see ATSAMF/trace.ino).
+ *
+ * The firmware, built with OPT_INPUT_TRACE, is run on a simulated ATmega328P
+ * (see sim.c) with the EEPROM from the trace. The recorded inputs are applied
+ * on the same ticks of the Timer1 ISR as on the rig. Since the simulated
+ * firmware records a trace as well, the TX and frequency changes of the replay
+ * can be compared to those of the rig. The run fails when they differ.
+ *
+ * Usage: replay_avr [-t TICKS] FIRMWARE.elf SYMBOLS TRACE
+ *
+ * SYMBOLS is the output of avr-nm -C on the firmware. TRACE is the output of
+ * the rig on the serial port. Events that are at most TICKS ms (default 2)
+ * apart are considered equal.
+ *
+ * The replay starts at power-on with all inputs released. When the ring buffer
+ * on the rig has wrapped, the inputs before the oldest event are unknown, and
+ * only the events after it are compared. The EEPROM is that at the time of the
+ * dump, so a memory that was recorded during the trace is already there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define TRACE_LENGTH 256 /* See ATSAMF/trace.h */
+#define TRACE_TX_OFF 0x80
+#define TRACE_TX_ON  0x81
+#define TRACE_FREQ   0x82
+
+#define EEPROM_SIZE 1024
+#define MAX_EVENTS 16384
+#define LOOKAHEAD 8 /* Number of events to look ahead after a difference */
+
+struct event {
+	unsigned long time;
+	uint8_t type;
+	uint32_t freq;
+};
+
+/* A trace from the rig */
+static unsigned long trace_start;
+static int trace_wrapped;
+static uint8_t trace_data[TRACE_LENGTH];
+static unsigned int trace_size;
+static uint8_t eeprom[EEPROM_SIZE];
+static unsigned int eeprom_size;
+
+static struct event rig[MAX_EVENTS];
+static unsigned int rig_count;
+static struct event replay[MAX_EVENTS];
+static unsigned int replay_count;
+
+/* RAM addresses in the simulated firmware */
+static unsigned long tcount_address;
+static unsigned long buffer_address;
+static unsigned long head_address;
+static unsigned long tail_address;
+static unsigned long tail_time_address;
+
+static unsigned int read_hex(const char *path, const char *hex,
+		uint8_t *data, unsigned int size, unsigned int max)
+{
+	unsigned int b;
+
+	while (sscanf(hex, "%2x", &b) == 1) {
+		if (size == max) {
+			fprintf(stderr, "%s: too much data\n", path);
+			exit(-1);
+		}
+		data[size++] = b;
+		hex += 2;
+	}
+
+	return size;
+}
+
+static void read_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		exit(-1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		switch (line[0]) {
+			case 'T':
+				trace_start = strtoul(line + 2, NULL, 10);
+				break;
+			case 'W':
+				trace_wrapped = atoi(line + 2);
+				break;
+			case 'D':
+				trace_size = read_hex(path, line + 2, trace_data, trace_size, TRACE_LENGTH);
+				break;
+			case 'E':
+				eeprom_size = read_hex(path, line + 2, eeprom, eeprom_size, EEPROM_SIZE);
+				break;
+		}
+	}
+
+	fclose(f);
+
+	if (!trace_size) {
+		fprintf(stderr, "%s: no events\n", path);
+		exit(-1);
+	}
+}
+
+static void add_event(struct event *events, unsigned int *count,
+		const struct event *event)
+{
+	if (*count == MAX_EVENTS) {
+		fprintf(stderr, "too many events\n");
+		exit(-1);
+	}
+	events[(*count)++] = *event;
+}
+
+/**
+ * Decode one event.
+ *
+ * @param get a function that returns the byte at an index in the trace.
+ * @param i the index of the event; is moved to the next event.
+ * @param time the time of the previous event, or NULL for the first event; in
+ *   that case the time of the event should already be set.
+ */
+static void decode_event(uint8_t (*get)(unsigned int), unsigned int *i,
+		struct event *event, const unsigned long *time)
+{
+	unsigned long delta = 0;
+	int shift = 0;
+	uint8_t b;
+
+	do {
+		b = get((*i)++);
+		delta |= (unsigned long) (b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	if (time)
+		event->time = *time + delta;
+	event->type = get((*i)++);
+	event->freq = 0;
+	if (event->type == TRACE_FREQ) {
+		for (int n = 0; n < 4; n++)
+			event->freq |= (uint32_t) get((*i)++) << (8 * n);
+	}
+}
+
+static uint8_t rig_byte(unsigned int i)
+{
+	if (i >= trace_size) {
+		fprintf(stderr, "trace ends in the middle of an event\n");
+		exit(-1);
+	}
+	return trace_data[i];
+}
+
+static uint8_t replay_byte(unsigned int i)
+{
+	return avr->data[buffer_address + (i & (TRACE_LENGTH - 1))];
+}
+
+static void decode_rig(void)
+{
+	struct event event;
+	unsigned int i = 0;
+
+	event.time = trace_start;
+	decode_event(rig_byte, &i, &event, NULL);
+	add_event(rig, &rig_count, &event);
+
+	while (i < trace_size) {
+		decode_event(rig_byte, &i, &event, &rig[rig_count - 1].time);
+		add_event(rig, &rig_count, &event);
+	}
+}
+
+static unsigned long data_symbol(const char *path, const char *name)
+{
+	unsigned long address = sim_data_symbol(path, name);
+	if (!address) {
+		fprintf(stderr, "%s: %s not found (built without OPT_INPUT_TRACE?)\n",
+				path, name);
+		exit(-1);
+	}
+	return address;
+}
+
+static void read_symbols(const char *path)
+{
+	tcount_address = data_symbol(path, "tcount");
+	buffer_address = data_symbol(path, "trace_buffer");
+	head_address = data_symbol(path, "trace_head");
+	tail_address = data_symbol(path, "trace_tail");
+	tail_time_address = data_symbol(path, "trace_tail_time");
+}
+
+/**
+ * Copy new events from the trace of the simulated firmware. Must only be
+ * called when interrupts are enabled, so that no event is half written.
+ *
+ * @param position the index of the next event to copy; is updated.
+ */
+static void read_replay_events(unsigned int *position)
+{
+	unsigned int head = sim_read_ram(head_address, 2);
+	struct event event;
+
+	if (!replay_count) {
+		if (head == sim_read_ram(tail_address, 2))
+			return;
+		*position = sim_read_ram(tail_address, 2);
+		event.time = sim_read_ram(tail_time_address, 4);
+		decode_event(replay_byte, position, &event, NULL);
+		add_event(replay, &replay_count, &event);
+	}
+
+	while ((*position & (TRACE_LENGTH - 1)) != head) {
+		decode_event(replay_byte, position, &event, &replay[replay_count - 1].time);
+		add_event(replay, &replay_count, &event);
+	}
+}
+
+static void apply_inputs(uint8_t *current, uint8_t bits)
+{
+	for (unsigned i = 0; i < INPUT_COUNT; i++)
+		if ((*current ^ bits) & (1 << i))
+			sim_set_input(&inputs[i], bits & (1 << i));
+	*current = bits;
+}
+
+/**
+ * Run the firmware until the time of the last event of the rig. An input is
+ * applied just before the tick on which the rig recorded it, since
+ * buttons_isr() records the inputs right after incrementing tcount.
+ */
+static void run(const char *elf)
+{
+	unsigned long end = rig[rig_count - 1].time + 1;
+	unsigned long tcount, last_tcount = -1;
+	unsigned int next = 0, position = 0;
+	uint8_t current = 0;
+
+	sim_start(elf);
+	sim_load_eeprom(eeprom, eeprom_size);
+
+	for (;;) {
+		int state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "%s: simulation stopped\n", elf);
+			exit(-1);
+		}
+
+		if (!avr->sreg[S_I])
+			continue;
+		tcount = sim_read_ram(tcount_address, 4);
+		if (tcount == last_tcount)
+			continue;
+		last_tcount = tcount;
+
+		read_replay_events(&position);
+		if (tcount >= end)
+			break;
+
+		for (; next < rig_count && rig[next].time <= tcount + 1; next++)
+			if (rig[next].type < TRACE_TX_OFF)
+				apply_inputs(&current, rig[next].type);
+	}
+}
+
+static int is_output(const struct event *event)
+{
+	return event->type == TRACE_TX_ON || event->type == TRACE_TX_OFF ||
+		event->type == TRACE_FREQ;
+}
+
+static int same_output(const struct event *a, const struct event *b)
+{
+	return a->type == b->type && a->freq == b->freq;
+}
+
+static void print_event(const char *prefix, const struct event *event)
+{
+	printf("%s %10lu ", prefix, event->time);
+	switch (event->type) {
+		case TRACE_TX_ON:  printf("TX on\n"); break;
+		case TRACE_TX_OFF: printf("TX off\n"); break;
+		case TRACE_FREQ:   printf("frequency %lu Hz\n", (unsigned long) event->freq / 100); break;
+	}
+}
+
+/**
+ * Compare the outputs of the rig and the replay from the time of the oldest
+ * event of the rig. After a difference, the next LOOKAHEAD outputs of the
+ * replay are searched for the output of the rig to realign.
+ *
+ * @return the number of differences.
+ */
+static unsigned int compare(unsigned long tolerance)
+{
+	unsigned long start = trace_wrapped ? trace_start : 0;
+	unsigned int differences = 0, compared = 0;
+	unsigned int r = 0, s = 0;
+
+	for (; r < rig_count; r++) {
+		if (!is_output(&rig[r]))
+			continue;
+
+		while (s < replay_count && (!is_output(&replay[s]) || replay[s].time < start))
+			s++;
+
+		unsigned int match = s;
+		for (unsigned int n = 0; match < replay_count && n < LOOKAHEAD; match++) {
+			if (!is_output(&replay[match]))
+				continue;
+			if (same_output(&rig[r], &replay[match]))
+				break;
+			n++;
+		}
+
+		compared++;
+		if (match == replay_count || !same_output(&rig[r], &replay[match])) {
+			print_event("- rig   ", &rig[r]);
+			differences++;
+			continue;
+		}
+
+		for (; s < match; s++) {
+			if (is_output(&replay[s])) {
+				print_event("+ replay", &replay[s]);
+				differences++;
+			}
+		}
+
+		long offset = (long) (replay[s].time - rig[r].time);
+		if (offset > (long) tolerance || -offset > (long) tolerance) {
+			print_event("- rig   ", &rig[r]);
+			print_event("+ replay", &replay[s]);
+			differences++;
+		}
+		s++;
+	}
+
+	for (; s < replay_count; s++) {
+		if (is_output(&replay[s]) && replay[s].time >= start) {
+			print_event("+ replay", &replay[s]);
+			differences++;
+		}
+	}
+
+	printf("%u outputs of the rig compared, %u differences\n", compared, differences);
+	return differences;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long tolerance = 2;
+
+	if (argc > 2 && !strcmp(argv[1], "-t")) {
+		tolerance = strtoul(argv[2], NULL, 10);
+		argv += 2;
+		argc -= 2;
+	}
+
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s [-t TICKS] FIRMWARE.elf SYMBOLS TRACE\n", argv[0]);
+		return -1;
+	}
+
+	read_symbols(argv[2]);
+	read_trace(argv[3]);
+	decode_rig();
+
+	if (trace_wrapped)
+		fprintf(stderr, "warning: the trace has wrapped; comparing from %lu ms\n",
+				trace_start);
+
+	run(argv[1]);
+
+	return compare(tolerance) ? 1 : 0;
+}
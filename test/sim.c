@@ -0,0 +1,191 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+/**
+ * The simulated rig for bench_avr.c and replay_avr.c: an ATmega328P in simavr
+ * running the firmware, with the Si5351 replaced by an I2C stub. The display
+ * needs no stub, since its busy flag reads as ready.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_elf.h>
+#include <simavr/avr_eeprom.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_twi.h>
+
+#include "sim.h"
+
+#define SI5351_ADDRESS 0x60
+#define DATA_OFFSET 0x800000 /* offset of RAM addresses in avr-nm */
+
+const struct input inputs[INPUT_COUNT] = {
+	{"encoder_data",   'D', 0},
+	{"encoder_clock",  'D', 1},
+	{"encoder_button", 'D', 2},
+	{"rit",            'D', 3},
+	{"keyer",          'D', 4},
+	{"dot",            'C', 2},
+	{"dash",           'C', 3},
+};
+
+avr_t *avr;
+unsigned long twi_transactions;
+
+/**
+ * The I2C stub. It acknowledges everything sent to the Si5351 and answers 0
+ * to reads (i.e., the device is always ready).
+ */
+static avr_irq_t *twi_irq;
+static uint8_t twi_selected;
+
+static void twi_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	avr_twi_msg_irq_t v;
+	v.u.v = value;
+
+	if (v.u.twi.msg & TWI_COND_STOP)
+		twi_selected = 0;
+
+	if (v.u.twi.msg & TWI_COND_START) {
+		twi_selected = 0;
+		if ((v.u.twi.addr >> 1) == SI5351_ADDRESS) {
+			twi_selected = v.u.twi.addr;
+			twi_transactions++;
+			avr_raise_irq(twi_irq + TWI_IRQ_INPUT,
+					avr_twi_irq_msg(TWI_COND_ACK, twi_selected, 1));
+		}
+	}
+
+	if (!twi_selected)
+		return;
+
+	if (v.u.twi.msg & TWI_COND_WRITE)
+		avr_raise_irq(twi_irq + TWI_IRQ_INPUT,
+				avr_twi_irq_msg(TWI_COND_ACK, twi_selected, 1));
+	if (v.u.twi.msg & TWI_COND_READ)
+		avr_raise_irq(twi_irq + TWI_IRQ_INPUT,
+				avr_twi_irq_msg(TWI_COND_READ, twi_selected, 0));
+}
+
+static void attach_twi(void)
+{
+	static const char *names[2] = {"8>si5351.in", "32<si5351.out"};
+
+	twi_irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+	avr_irq_register_notify(twi_irq + TWI_IRQ_OUTPUT, twi_hook, NULL);
+	avr_connect_irq(twi_irq + TWI_IRQ_INPUT,
+			avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+	avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+			twi_irq + TWI_IRQ_OUTPUT);
+}
+
+/**
+ * Create the simulated rig with the firmware loaded and all inputs released.
+ */
+void sim_start(const char *elf)
+{
+	elf_firmware_t firmware = {{0}};
+
+	if (elf_read_firmware(elf, &firmware)) {
+		fprintf(stderr, "%s: cannot read firmware\n", elf);
+		exit(-1);
+	}
+
+	avr = avr_make_mcu_by_name("atmega328p");
+	avr_init(avr);
+	avr->frequency = F_CPU;
+	avr_load_firmware(avr, &firmware);
+
+	attach_twi();
+	sim_release_inputs();
+}
+
+void sim_load_eeprom(uint8_t *data, unsigned int size)
+{
+	avr_eeprom_desc_t desc = {
+		.ee = data,
+		.offset = 0,
+		.size = size,
+	};
+
+	avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &desc);
+}
+
+/**
+ * Press or release an input (a pressed input pulls the pin low).
+ */
+void sim_set_input(const struct input *input, int pressed)
+{
+	avr_raise_irq(avr_io_getirq(avr,
+				AVR_IOCTL_IOPORT_GETIRQ(input->port), input->pin),
+			!pressed);
+}
+
+void sim_release_inputs(void)
+{
+	for (unsigned i = 0; i < INPUT_COUNT; i++)
+		sim_set_input(&inputs[i], 0);
+}
+
+const struct input *sim_find_input(const char *name)
+{
+	for (unsigned i = 0; i < INPUT_COUNT; i++)
+		if (!strcmp(inputs[i].name, name))
+			return &inputs[i];
+	return NULL;
+}
+
+/**
+ * Find a variable in the output of avr-nm -C.
+ *
+ * @return the RAM address, or 0 if it is not found.
+ */
+unsigned long sim_data_symbol(const char *path, const char *name)
+{
+	FILE *f = fopen(path, "r");
+	char line[256], type, symbol[200];
+	unsigned long address, result = 0;
+
+	if (!f) {
+		perror(path);
+		exit(-1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx %c %199[^\n]", &address, &type, symbol) != 3)
+			continue;
+		if (strchr("BbDd", type) && !strcmp(symbol, name)) {
+			result = address - DATA_OFFSET;
+			break;
+		}
+	}
+
+	fclose(f);
+	return result;
+}
+
+/**
+ * Read a little endian value of 1 to 4 bytes from RAM.
+ */
+uint32_t sim_read_ram(unsigned long address, int size)
+{
+	uint32_t value = 0;
+	while (size--)
+		value = value << 8 | avr->data[address + size];
+	return value;
+}
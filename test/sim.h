@@ -0,0 +1,47 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef _H_SIM
+#define _H_SIM
+
+#include <simavr/sim_avr.h>
+
+#define F_CPU 16000000ul
+#define CYCLES_PER_MS (F_CPU / 1000)
+
+/* Inputs of the rig; the order matches the bits of the inputs in a trace (see
+ * ATSAMF/trace.h) */
+struct input {
+	const char *name;
+	char port;
+	int pin;
+};
+
+extern const struct input inputs[];
+
+#define INPUT_COUNT 7
+
+extern avr_t *avr;
+extern unsigned long twi_transactions;
+
+void sim_start(const char *elf);
+void sim_load_eeprom(uint8_t *data, unsigned int size);
+void sim_set_input(const struct input *input, int pressed);
+void sim_release_inputs(void);
+const struct input *sim_find_input(const char *name);
+unsigned long sim_data_symbol(const char *path, const char *name);
+uint32_t sim_read_ram(unsigned long address, int size);
+
+#endif
@@ -25,16 +25,17 @@ extern "C"{
 #endif
 
 #define DOT_TIME 10
-#define BUFFER_SIZE 128
+#define BUFFER_SIZE 512
 
 struct atsamf state;
+volatile unsigned long tcount;
 
 static char *character;
 static char result[BUFFER_SIZE];
 static char *result_ptr;
 
 static void add_result(char c) {
-	if (result_ptr-BUFFER_SIZE >= result_ptr) {
+	if (result_ptr - result >= BUFFER_SIZE - 1) {
 		printf("result buffer overflow\n");
 		exit(-1);
 	}
@@ -56,6 +57,12 @@ void delay(unsigned long ms) {
 void invalidate_display(void) {
 }
 
+void watchdog_feed(void) {
+}
+
+void task_post_in(enum task task, unsigned int ms) {
+}
+
 int digitalRead(uint8_t pin) {
 	int enabled = 0;
 
@@ -95,6 +102,23 @@ void key_handle_dot(void) {
 void key_handle_dashdot_end(void) {
 }
 
+void key_handle_decoded(byte character) {
+	char i;
+
+	if (character == 0x00) {
+		add_result('/');
+		add_result(' ');
+		return;
+	}
+
+	for (i = 7; i >= 0; i--)
+		if (character & (1 << i))
+			break;
+	for (i--; i >= 0; i--)
+		add_result(character & (1 << i) ? '-' : '.');
+	add_result(' ');
+}
+
 char *run_test(char *_character) {
 	state.key.dash_time = DOT_TIME * 3;
 	state.key.dot_time = DOT_TIME;
@@ -105,9 +129,15 @@ char *run_test(char *_character) {
 	*result_ptr = '\0';
 
 	while (*character) {
+		/* The keyer is called on every tick until the end of the character,
+		 * like by the keying task in the firmware. */
 		iambic_key();
+		while (state.key.busy) {
+			delay(1);
+			iambic_key();
+		}
 
-		/* We get here when after 7 empty periods: the keying routine returns.
+		/* We get here when after 7 empty periods: the character has ended.
 		 * If the input is not finished, we need to delay for one DOT_TIME so
 		 * that the next character is loaded (see `delay`), and continue. */
 		state.key.timer = DOT_TIME;
@@ -117,6 +147,36 @@ char *run_test(char *_character) {
 	return result;
 }
 
+char *run_straight_test(unsigned char dot_time, unsigned int *trace, int length) {
+	unsigned long time = 0;
+	int i;
+
+	state.key.dot_time = dot_time;
+	straight_decoder_reset();
+
+	result_ptr = result;
+	*result_ptr = '\0';
+
+	/* The trace alternates marks and spaces, starting with a mark. During
+	 * spaces, the decoder is polled every ms like in the firmware. */
+	for (i = 0; i < length; i++) {
+		if (i % 2 == 0) {
+			straight_decoder_down(time);
+			time += trace[i];
+			straight_decoder_up(time);
+		} else {
+			unsigned long end = time + trace[i];
+			for (; time < end; time++)
+				straight_decoder_poll(time);
+		}
+	}
+
+	/* Flush the last character and word. */
+	straight_decoder_poll(time + 60000);
+
+	return result;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,3 +16,4 @@
  */
 
 char *run_test(char *test_case);
+char *run_straight_test(unsigned char dot_time, unsigned int *trace, int length);
@@ -0,0 +1,99 @@
+/**
+ * This is software for the ATSAMF rig. Fore more information, see the
+ * README.md file.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#include "test_memory.h"
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include "ATSAMF.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* state, tcount and task_post_in() are shared with test_key.c. */
+
+const byte MORSE_DIGITS[] = {M0,M1,M2,M3,M4,M5,M6,M7,M8,M9};
+
+static unsigned char eeprom[E2END + 1];
+static unsigned char result[MEMORY_MAX_LENGTH + 1];
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+	return eeprom[(uintptr_t) address];
+}
+
+void eeprom_write_byte(uint8_t *address, uint8_t value) {
+	eeprom[(uintptr_t) address] = value;
+}
+
+void task_post(enum task task) {
+}
+
+byte morse_digit(byte character) {
+	return 0xff;
+}
+
+void morse_send(byte character, byte break_in) {
+}
+
+void morse_pause(unsigned int time, byte break_in) {
+}
+
+int memory_slot_length(void) {
+	return MEMORY_LENGTH;
+}
+
+/* Erase the EEPROM and store ten memories of MEMORY_LENGTH bytes from
+ * MEMORY_EEPROM_START, as they were stored before the index and the links
+ * were introduced. */
+void load_legacy_memories(unsigned char *slots) {
+	int i;
+
+	for (i = 0; i <= E2END; i++)
+		eeprom[i] = 0xff;
+	for (i = 0; i < 10 * MEMORY_LENGTH; i++)
+		eeprom[MEMORY_EEPROM_START + i] = slots[i];
+}
+
+/* Record a memory like in S_MEM_ENTER, until the recorder is full.
+ * Returns the number of characters that were recorded. */
+int record_memory(unsigned char nr, unsigned char *characters, int length) {
+	int i;
+
+	memory_record_start();
+	for (i = 0; i < length; i++)
+		if (!memory_record_add(characters[i]))
+			break;
+	memory_record_commit(nr);
+
+	return i;
+}
+
+/* Read a memory like it is transmitted. The result ends with 0xff. */
+unsigned char *read_memory(unsigned char nr) {
+	int i = 0;
+
+	memory_tx_start(nr);
+	while (i < MEMORY_MAX_LENGTH && (result[i] = memory_tx_next()) != 0xff)
+		i++;
+	result[i] = 0xff;
+	memory_tx_cancel();
+
+	return result;
+}
+
+#ifdef __cplusplus
+}
+#endif